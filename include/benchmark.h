@@ -0,0 +1,46 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Cycle counts of the queue between the USB IRQ and the main loop,
+ * measured once at startup with DWT->CYCCNT, if built with
+ * ENABLE_BENCHMARK on a core that has it (STM32F4). The results are
+ * printed with semihosting, or can be read from benchmark_result with
+ * the debugger.
+ */
+struct benchmark_result {
+	uint32_t frame_ring_push;	/* frame_ring_push() */
+	uint32_t frame_ring_pop;	/* frame_ring_peek() + frame_ring_pop() */
+	uint32_t list_add;			/* list_add_tail() with IRQ disabled */
+	uint32_t list_del;			/* list_first_entry() + list_del() with IRQ disabled */
+};
+
+extern struct benchmark_result benchmark_result;
+
+void benchmark_run(void);
@@ -29,6 +29,9 @@
 #include <stdbool.h>
 
 #include "config.h"
+#include "frame_heap.h"
+#include "frame_ring.h"
+#include "gs_host_frame_compact.h"
 #include "gs_usb.h"
 #include "hal_include.h"
 #include "led.h"
@@ -43,6 +46,72 @@ struct can_drv_reg_status {
 #endif
 };
 
+// Number of frames the CAN controller can have in flight.
+#define CAN_TX_SLOTS 3
+
+#if defined(CONFIG_BXCAN)
+/*
+ * Frames drained from the RX FIFO by the RX interrupt, kept as the
+ * raw mailbox registers and decoded by can_receive() in the main
+ * loop. Single producer (the interrupt), single consumer.
+ */
+#define BXCAN_RX_RING_SIZE 16
+
+struct bxcan_rx_mailbox {
+	uint32_t rir;
+	uint32_t rdtr;
+	uint32_t rdlr;
+	uint32_t rdhr;
+	uint32_t timestamp_us;
+};
+
+struct bxcan_rx_ring {
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	volatile uint32_t dropped;	/* frames dropped as the ring was full */
+	uint32_t dropped_seen;
+	struct bxcan_rx_mailbox buf[BXCAN_RX_RING_SIZE];
+};
+
+/*
+ * Extends the 16 bit CAN bit time stamps of the received frames (TTCM)
+ * to the time of timer_get(). The bxCAN timer can't be read, so a
+ * frame's time stamp is taken relative to a base frame, which was
+ * assumed to be received when it was drained. Only used by the RX
+ * interrupt.
+ */
+struct bxcan_rx_time {
+	uint32_t base_us;
+	uint16_t base_time;
+	bool valid;
+	uint32_t bit_time_q4;	/* nominal bit time in 1/16 us */
+};
+
+/*
+ * Completion of a TX mailbox, set to an enum can_drv_tx_status by
+ * can_send() and the TX interrupt, and consumed by can_drv_tx_status().
+ */
+struct bxcan_tx_mailbox {
+	volatile uint8_t status;
+	volatile uint32_t timestamp_us;
+};
+#elif defined(CONFIG_M_CAN)
+/*
+ * Completion of a TX buffer, set to an enum can_drv_tx_status by
+ * can_send() and by the TX event FIFO, consumed by can_drv_tx_status().
+ */
+struct m_can_tx_buffer {
+	uint8_t status;
+	uint32_t timestamp_us;
+};
+#endif
+
+// An ID of the TX coalesce table and its queued frame object.
+struct can_tx_coalesce {
+	uint32_t can_id;
+	frame_ring_idx_t idx;
+};
+
 enum can_channel_flag {
 	CAN_CHANNEL_FLAG_BITTIMING_SET = BIT(0),
 	CAN_CHANNEL_FLAG_DATA_BITTIMING_SET = BIT(1),
@@ -54,16 +123,45 @@ enum can_channel_flag {
 typedef struct can_channel {
 #if defined (CONFIG_BXCAN)
 	CAN_TypeDef *instance;
+	struct bxcan_rx_ring rx_ring;
+	struct bxcan_rx_time rx_time;
+	struct bxcan_tx_mailbox tx_mailbox[CAN_TX_SLOTS];
+	volatile uint8_t tx_cancel;	/* TX mailboxes with an abort request */
 #elif defined(CONFIG_M_CAN)
 	FDCAN_HandleTypeDef channel;
+	struct m_can_tx_buffer tx_buffer[CAN_TX_SLOTS];
+	uint8_t tx_cancel;	/* TX buffers with a cancellation request */
 #endif
 	struct can_drv_reg_status reg_status;
-	struct list_head list_from_host;
+	struct frame_ring ring_from_host;
+	struct frame_heap heap_from_host;
+	struct can_tx_coalesce tx_coalesce[GS_DEVICE_TX_COALESCE_MAX];
+	uint8_t tx_coalesce_count;
+	unsigned int tx_coalesce_pos;	/* ring position to look at next */
+	volatile unsigned int tx_abort_flush_seq;
+	frame_ring_idx_t tx_slot[CAN_TX_SLOTS];	/* frames waiting for their TX completion */
+	struct list_head list_to_host;
+	uint16_t to_host_deficit;
 	led_data_t leds;
 	uint32_t feature;
 	enum can_channel_flag flags;
 	enum gs_can_state state;
 	uint32_t bus_off_restart;
+	uint32_t tx_echo_interval;
+	uint32_t tx_echo_count;
+	uint16_t pool_used;
+	uint16_t pool_quota_min;
+	uint16_t pool_quota_max;
+	uint32_t pool_quota_hits;
+	uint32_t rx_dropped;
+	uint32_t err_dropped;
+	uint32_t tx_expired;
+	uint32_t tx_failed;
+	uint32_t tx_rejected;
+	bool rx_overflow;
+	bool rx_overflow_reported;
+	enum gs_device_rx_format_mode rx_format;
+	struct gs_host_frame_compact_ts rx_compact_ts;
 	struct gs_device_bittiming bittiming;
 #ifdef CONFIG_CANFD
 	struct gs_device_bittiming data_bittiming;
@@ -97,4 +195,4 @@ static inline void can_set_filter(can_data_t __maybe_unused *channel, const stru
 bool can_receive(can_data_t *channel, struct gs_host_frame *rx_frame);
 bool can_is_rx_pending(can_data_t *channel);
 
-bool can_send(can_data_t *channel, struct gs_host_frame *frame);
+bool can_send(can_data_t *channel, struct gs_host_frame *frame, unsigned int *slot);
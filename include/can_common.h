@@ -40,6 +40,22 @@
 #define CAN_LEC_CRC_ERROR	6
 #define CAN_LEC_SOFTWARE	7
 
+// Features implemented by the USB and queueing code, independent of
+// the CAN controller.
+#define GS_CAN_FEATURE_FIRMWARE_COMMON \
+	(GS_CAN_FEATURE_IN_BATCH | \
+	 GS_CAN_FEATURE_OUT_BATCH | \
+	 GS_CAN_FEATURE_TX_ECHO_SUPPRESS | \
+	 GS_CAN_FEATURE_STATUS_EP | \
+	 (IS_ENABLED(CONFIG_USB_EP_PER_CHANNEL) ? \
+	  GS_CAN_FEATURE_CHANNEL_EP : 0) | \
+	 GS_CAN_FEATURE_RX_FORMAT_COMPACT | \
+	 GS_CAN_FEATURE_POOL_QUOTA | \
+	 GS_CAN_FEATURE_TX_PRIO | \
+	 GS_CAN_FEATURE_TX_COALESCE | \
+	 GS_CAN_FEATURE_TX_DEADLINE | \
+	 GS_CAN_FEATURE_TX_ABORT)
+
 bool can_check_feature_ok(const can_data_t *channel, const uint32_t feature);
 bool can_check_bittiming_ok(const struct can_bittiming_const *btc, const struct gs_device_bittiming *timing);
 void can_set_bittiming(struct can_channel *channel, const struct gs_device_bittiming *bt);
@@ -112,6 +128,7 @@ static inline bool can_is_lec_error(const uint8_t lec)
 
 bool can_is_enabled(const struct can_channel *channel);
 void can_enable(struct can_channel *channel, uint32_t mode);
+void can_abort_tx(struct can_channel *channel);
 void can_disable(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel);
 void can_get_device_state(const struct can_channel *channel, struct gs_device_state *state);
 
@@ -49,3 +49,15 @@ void can_drv_get_device_state(const struct can_channel *channel, struct gs_devic
 void can_drv_handle_state_change(const struct can_channel *channel, struct gs_host_frame *frame);
 
 void can_drv_handle_bus_off_recovery(struct can_channel *channel);
+
+void can_drv_abort_tx(struct can_channel *channel);
+
+enum can_drv_tx_status {
+	CAN_DRV_TX_IDLE = 0,
+	CAN_DRV_TX_PENDING,
+	CAN_DRV_TX_OK,
+	CAN_DRV_TX_FAILED,
+	CAN_DRV_TX_ABORTED,
+};
+
+enum can_drv_tx_status can_drv_tx_status(struct can_channel *channel, unsigned int slot, uint32_t *timestamp_us);
@@ -57,6 +57,12 @@
 #define __weak __attribute__((weak))
 #endif
 
+// Variables only accessed by the CPU, never by DMA, that benefit
+// from core coupled memory on targets that have it.
+#ifndef __ccm
+#define __ccm __attribute__((__section__(".ccm")))
+#endif
+
 #define barrier()	   __asm__ __volatile__ ("" : : : "memory")
 
 #define ACCESS_ONCE(x) (*(volatile __typeof(x) *)&(x))
@@ -38,8 +38,6 @@ THE SOFTWARE.
 
 #pragma once
 
-#define CAN_QUEUE_SIZE				 (64 * NUM_CAN_CHANNEL)
-
 #define USBD_VID					 0x1d50
 #define USBD_PID_FS					 0x606f
 #define USBD_LANGID_STRING			 1033
@@ -435,6 +433,7 @@ THE SOFTWARE.
 	#define CAN_CLOCK_SPEED			 40000000
 	#define NUM_CAN_CHANNEL			 2
 	#define CONFIG_CANFD			 1
+	#define CONFIG_USB_EP_PER_CHANNEL 1
 
 	#define CONFIG_PHY				 1
 	#define CONFIG_PHY_STANDBY		 1
@@ -462,6 +461,10 @@ THE SOFTWARE.
 	#error please define BOARD
 #endif
 
+#if defined(CONFIG_USB_EP_PER_CHANNEL) && (NUM_CAN_CHANNEL < 2)
+#error Defined CONFIG_USB_EP_PER_CHANNEL with a single CAN channel
+#endif
+
 #ifndef CONFIG_PHY
 #if defined(CONFIG_PHY_STANDBY) || defined(CONFIG_PHY_SILENT)
 #error Defined CONFIG_PHY_STANDBY or CONFIG_PHY_SILENT without CONFIG_PHY
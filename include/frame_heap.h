@@ -0,0 +1,182 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame_ring.h"
+#include "gs_usb.h"
+
+/*
+ * Binary min-heap of frame object indices, see
+ * gs_host_frame_object_from_idx(), ordered by a key provided by the
+ * caller. Entries with equal keys are returned in the order they
+ * were pushed. Not thread safe, used by the main loop only.
+ */
+#define FRAME_HEAP_SIZE 32
+
+struct frame_heap_entry {
+	uint32_t key;
+	uint16_t seq;
+	frame_ring_idx_t idx;
+};
+
+struct frame_heap {
+	struct frame_heap_entry entry[FRAME_HEAP_SIZE];
+	unsigned int count;
+	uint16_t seq;
+	unsigned int flush_seq;	/* of the frame_ring feeding the heap */
+};
+
+static inline void frame_heap_init(struct frame_heap *heap)
+{
+	heap->count = 0;
+	heap->seq = 0;
+	heap->flush_seq = 0;
+}
+
+static inline bool frame_heap_is_empty(const struct frame_heap *heap)
+{
+	return heap->count == 0;
+}
+
+static inline bool frame_heap_is_full(const struct frame_heap *heap)
+{
+	return heap->count == FRAME_HEAP_SIZE;
+}
+
+static inline bool frame_heap_entry_before(const struct frame_heap_entry *a,
+										   const struct frame_heap_entry *b)
+{
+	if (a->key != b->key)
+		return a->key < b->key;
+
+	// The heap never holds more than FRAME_HEAP_SIZE entries, so the
+	// sequence numbers can be compared across a wrap around.
+	return (int16_t)(a->seq - b->seq) < 0;
+}
+
+static inline void frame_heap_swap(struct frame_heap *heap,
+								   unsigned int a, unsigned int b)
+{
+	const struct frame_heap_entry tmp = heap->entry[a];
+
+	heap->entry[a] = heap->entry[b];
+	heap->entry[b] = tmp;
+}
+
+// The caller has to check for free space before pushing.
+static inline void frame_heap_push(struct frame_heap *heap, uint32_t key,
+								   frame_ring_idx_t idx)
+{
+	unsigned int i = heap->count++;
+
+	heap->entry[i] = (struct frame_heap_entry){
+		.key = key,
+		.seq = heap->seq++,
+		.idx = idx,
+	};
+
+	while (i > 0) {
+		const unsigned int parent = (i - 1) / 2;
+
+		if (!frame_heap_entry_before(&heap->entry[i], &heap->entry[parent]))
+			break;
+
+		frame_heap_swap(heap, i, parent);
+		i = parent;
+	}
+}
+
+// Return the index with the smallest key, without removing it from
+// the heap, or false if the heap is empty.
+static inline bool frame_heap_peek(const struct frame_heap *heap, frame_ring_idx_t *idx)
+{
+	if (frame_heap_is_empty(heap))
+		return false;
+
+	*idx = heap->entry[0].idx;
+
+	return true;
+}
+
+// Remove the index returned by frame_heap_peek().
+static inline void frame_heap_pop(struct frame_heap *heap)
+{
+	unsigned int i = 0;
+
+	heap->entry[0] = heap->entry[--heap->count];
+
+	for (;;) {
+		const unsigned int left = 2 * i + 1;
+		const unsigned int right = left + 1;
+		unsigned int min = i;
+
+		if (left < heap->count &&
+			frame_heap_entry_before(&heap->entry[left], &heap->entry[min]))
+			min = left;
+
+		if (right < heap->count &&
+			frame_heap_entry_before(&heap->entry[right], &heap->entry[min]))
+			min = right;
+
+		if (min == i)
+			break;
+
+		frame_heap_swap(heap, i, min);
+		i = min;
+	}
+}
+
+// Replace the index old by idx, keeping its key and place in the
+// order. Return false if old is not in the heap.
+static inline bool frame_heap_replace(struct frame_heap *heap, frame_ring_idx_t old,
+									  frame_ring_idx_t idx)
+{
+	for (unsigned int i = 0; i < heap->count; i++) {
+		if (heap->entry[i].idx == old) {
+			heap->entry[i].idx = idx;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Key of a frame for the TX priority heap, its arbitration field as
+// sent on the bus: the base ID, RTR or SRR, IDE, the extended ID and
+// RTR. The lower the key, the higher the priority.
+static inline uint32_t can_tx_prio_key(const struct gs_host_frame *frame)
+{
+	const uint32_t rtr = !!(frame->can_id & CAN_RTR_FLAG);
+
+	if (!(frame->can_id & CAN_EFF_FLAG))
+		return (frame->can_id & CAN_SFF_MASK) << 21 | rtr << 20;
+
+	const uint32_t id = frame->can_id & CAN_EFF_MASK;
+
+	return (id >> 18) << 21 | 1 << 20 | 1 << 19 | (id & 0x3FFFF) << 1 | rtr;
+}
@@ -0,0 +1,189 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "hal_include.h"
+
+/*
+ * Lock-free single-producer/single-consumer ring of frame object
+ * indices, see gs_host_frame_object_from_idx().
+ *
+ * head is only written by the producer, tail only by the consumer.
+ * Both are free running, the ring is empty if they are equal. The
+ * barriers make sure the slot is written before the producer
+ * publishes it and read before the consumer releases it.
+ *
+ * The producer has to check for free space before pushing.
+ *
+ * frame_ring_flush() may be called from another context than the
+ * consumer's, but not concurrently to the producer. It doesn't touch
+ * tail, instead the consumer drops the flushed entries with the help
+ * of frame_ring_peek_flushed().
+ */
+#define FRAME_RING_SIZE 64
+
+typedef uint16_t frame_ring_idx_t;
+
+// Marks an entry cleared by the consumer, see frame_ring_clear_at().
+#define FRAME_RING_IDX_NONE UINT16_MAX
+
+struct frame_ring {
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	volatile unsigned int flush_head;
+	volatile unsigned int flush_seq;
+	unsigned int flushed_seq;
+	frame_ring_idx_t buf[FRAME_RING_SIZE];
+};
+
+static inline void frame_ring_init(struct frame_ring *ring)
+{
+	BUILD_BUG_ON(FRAME_RING_SIZE & (FRAME_RING_SIZE - 1));
+
+	ring->head = 0;
+	ring->tail = 0;
+	ring->flush_head = 0;
+	ring->flush_seq = 0;
+	ring->flushed_seq = 0;
+}
+
+static inline unsigned int frame_ring_count(const struct frame_ring *ring)
+{
+	return ring->head - ring->tail;
+}
+
+static inline unsigned int frame_ring_space(const struct frame_ring *ring)
+{
+	return FRAME_RING_SIZE - frame_ring_count(ring);
+}
+
+static inline bool frame_ring_is_empty(const struct frame_ring *ring)
+{
+	return ring->head == ring->tail;
+}
+
+// Producer side only.
+static inline void frame_ring_push(struct frame_ring *ring, frame_ring_idx_t idx)
+{
+	const unsigned int head = ring->head;
+
+	ring->buf[head & (FRAME_RING_SIZE - 1)] = idx;
+	__DMB();
+	ring->head = head + 1;
+}
+
+// Consumer side only. Return the oldest index, without removing it
+// from the ring, or false if the ring is empty.
+static inline bool frame_ring_peek(const struct frame_ring *ring, frame_ring_idx_t *idx)
+{
+	const unsigned int tail = ring->tail;
+
+	if (ring->head == tail)
+		return false;
+
+	__DMB();
+	*idx = ring->buf[tail & (FRAME_RING_SIZE - 1)];
+
+	return true;
+}
+
+// Consumer side only. Like frame_ring_peek(), but return the index at
+// the free running position pos, between tail and head.
+static inline bool frame_ring_peek_at(const struct frame_ring *ring, unsigned int pos,
+									  frame_ring_idx_t *idx)
+{
+	if ((int)(ring->head - pos) <= 0)
+		return false;
+
+	__DMB();
+	*idx = ring->buf[pos & (FRAME_RING_SIZE - 1)];
+
+	return true;
+}
+
+// Consumer side only. Replace the index at the position pos, between
+// tail and head, by idx.
+static inline void frame_ring_set_at(struct frame_ring *ring, unsigned int pos,
+									 frame_ring_idx_t idx)
+{
+	ring->buf[pos & (FRAME_RING_SIZE - 1)] = idx;
+}
+
+// Consumer side only. Replace the index at the position pos, between
+// tail and head, by FRAME_RING_IDX_NONE. The entry still occupies its
+// slot until it is popped.
+static inline void frame_ring_clear_at(struct frame_ring *ring, unsigned int pos)
+{
+	frame_ring_set_at(ring, pos, FRAME_RING_IDX_NONE);
+}
+
+static inline unsigned int frame_ring_tail(const struct frame_ring *ring)
+{
+	return ring->tail;
+}
+
+// Consumer side only. Remove the index returned by frame_ring_peek().
+static inline void frame_ring_pop(struct frame_ring *ring)
+{
+	__DMB();
+	ring->tail = ring->tail + 1;
+}
+
+// Mark all entries currently in the ring as flushed.
+static inline void frame_ring_flush(struct frame_ring *ring)
+{
+	ring->flush_head = ring->head;
+	__DMB();
+	ring->flush_seq = ring->flush_seq + 1;
+}
+
+// Changes whenever frame_ring_flush() is called.
+static inline unsigned int frame_ring_flush_seq(const struct frame_ring *ring)
+{
+	return ring->flush_seq;
+}
+
+// Consumer side only. Like frame_ring_peek(), but only return entries
+// marked by frame_ring_flush().
+static inline bool frame_ring_peek_flushed(struct frame_ring *ring, frame_ring_idx_t *idx)
+{
+	const unsigned int seq = ring->flush_seq;
+
+	if (seq == ring->flushed_seq)
+		return false;
+
+	__DMB();
+	if ((int)(ring->flush_head - ring->tail) <= 0) {
+		ring->flushed_seq = seq;
+		return false;
+	}
+
+	return frame_ring_peek(ring, idx);
+}
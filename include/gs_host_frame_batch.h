@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+/*
+ * Layout of the bulk IN transfers of channels with
+ * GS_CAN_FEATURE_IN_BATCH, shared by the firmware and the host side
+ * decoder. Only depends on gs_usb.h, so that host tools can use it as
+ * is.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gs_host_frame_compact.h"
+#include "gs_usb.h"
+
+// Size of the data of a CAN-FD frame with GS_CAN_FEATURE_FD_DLC_TRIM,
+// padded to keep the following timestamp and frame aligned.
+static inline size_t gs_host_frame_batch_fd_data_len(const struct gs_host_frame *frame)
+{
+	return (can_fd_dlc2len(frame->can_dlc) + 3) & ~3;
+}
+
+// Size of frame on the IN endpoint of a channel with feature. fd tells
+// if the frame is a CAN-FD frame.
+static inline size_t gs_host_frame_batch_frame_size(uint32_t feature, bool fd,
+													const struct gs_host_frame *frame)
+{
+	const bool ts = feature & GS_CAN_FEATURE_HW_TIMESTAMP;
+
+	if (!fd)
+		return offsetof(struct gs_host_frame, classic_can) +
+			   (ts ? sizeof(struct classic_can_ts) : sizeof(struct classic_can));
+
+	if (feature & GS_CAN_FEATURE_FD_DLC_TRIM)
+		return offsetof(struct gs_host_frame, canfd) +
+			   gs_host_frame_batch_fd_data_len(frame) +
+			   (ts ? sizeof(u32) : 0);
+
+	return offsetof(struct gs_host_frame, canfd) +
+		   (ts ? sizeof(struct canfd_ts) : sizeof(struct canfd));
+}
+
+// Decode the frame at the beginning of buf, an IN batch of channels
+// with the features feature[], into frame. Trimmed CAN-FD frames are
+// expanded, so that the timestamp is at its usual place. frame must be
+// large enough for a CAN-FD frame with timestamp. Return the frame's
+// size in buf, or 0 if buf doesn't hold a complete frame.
+static inline size_t gs_host_frame_batch_decode(const uint8_t *buf, size_t len,
+												const uint32_t *feature, size_t nr_channels,
+												struct gs_host_frame *frame)
+{
+	const size_t header_len = offsetof(struct gs_host_frame, classic_can);
+
+	if (len < header_len)
+		return 0;
+
+	memcpy(frame, buf, header_len);
+	if (frame->channel >= nr_channels)
+		return 0;
+
+	const uint32_t channel_feature = feature[frame->channel];
+	const size_t size = gs_host_frame_batch_frame_size(channel_feature,
+													   frame->flags & GS_CAN_FLAG_FD,
+													   frame);
+	if (len < size)
+		return 0;
+
+	if (frame->flags & GS_CAN_FLAG_FD &&
+		channel_feature & GS_CAN_FEATURE_FD_DLC_TRIM &&
+		channel_feature & GS_CAN_FEATURE_HW_TIMESTAMP) {
+		memcpy(frame, buf, size - sizeof(u32));
+		memcpy(&frame->canfd_ts->timestamp_us, buf + size - sizeof(u32), sizeof(u32));
+	} else {
+		memcpy(frame, buf, size);
+	}
+
+	return size;
+}
@@ -0,0 +1,201 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+/*
+ * Encoder and decoder of the compact frame records, see struct
+ * gs_host_frame_compact. Only depends on gs_usb.h, so that host
+ * tools can use the decoder as is.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gs_usb.h"
+
+static inline uint8_t can_fd_dlc2len(uint8_t dlc)
+{
+	static const uint8_t len[] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64
+	};
+
+	return len[dlc & 0x0f];
+}
+
+// Length of the data of a CAN-FD or classic CAN frame with DLC dlc.
+static inline size_t can_dlc2len(uint8_t dlc, bool fd)
+{
+	if (fd)
+		return can_fd_dlc2len(dlc);
+
+	dlc &= 0x0f;
+
+	return dlc > 8 ? 8 : dlc;
+}
+
+// Upper bound of the size of the compact record of a frame.
+static inline size_t gs_host_frame_compact_size_max(size_t data_len)
+{
+	return sizeof(struct gs_host_frame_compact) + 2 * sizeof(u32) + data_len;
+}
+
+// Timestamp of the previous record of a channel.
+struct gs_host_frame_compact_ts {
+	uint32_t timestamp_us;
+	bool valid;
+};
+
+static inline uint8_t gs_host_frame_compact_tx_status(uint8_t flags)
+{
+	if (flags & GS_CAN_FLAG_TX_EXPIRED)
+		return GS_HOST_FRAME_COMPACT_TX_EXPIRED;
+
+	if (flags & GS_CAN_FLAG_TX_ABORTED)
+		return GS_HOST_FRAME_COMPACT_TX_ABORTED;
+
+	if (flags & GS_CAN_FLAG_TX_FAILED)
+		return GS_HOST_FRAME_COMPACT_TX_FAILED;
+
+	return GS_HOST_FRAME_COMPACT_TX_OK;
+}
+
+static inline uint8_t gs_host_frame_compact_tx_status_to_flags(uint8_t tx_status)
+{
+	static const uint8_t flags[] = {
+		[GS_HOST_FRAME_COMPACT_TX_OK] = 0,
+		[GS_HOST_FRAME_COMPACT_TX_EXPIRED] = GS_CAN_FLAG_TX_EXPIRED,
+		[GS_HOST_FRAME_COMPACT_TX_ABORTED] = GS_CAN_FLAG_TX_ABORTED,
+		[GS_HOST_FRAME_COMPACT_TX_FAILED] = GS_CAN_FLAG_TX_FAILED,
+	};
+
+	return flags[tx_status & 0x3];
+}
+
+// Encode frame of channel nr as compact record into buf, which must
+// hold at least gs_host_frame_compact_size_max() bytes. fd tells if
+// the frame is a CAN-FD frame, ts is the timestamp state of the
+// channel. Return the record's length.
+static inline size_t gs_host_frame_compact_encode(const struct gs_host_frame *frame, bool fd,
+												  uint8_t nr, struct gs_host_frame_compact_ts *ts,
+												  uint8_t *buf)
+{
+	const uint32_t timestamp_us = fd ?
+								  frame->canfd_ts->timestamp_us :
+								  frame->classic_can_ts->timestamp_us;
+	const uint32_t delta_us = timestamp_us - ts->timestamp_us;
+	const size_t data_len = can_dlc2len(frame->can_dlc, fd);
+	const uint8_t fd_flags = GS_CAN_FLAG_FD | GS_CAN_FLAG_BRS | GS_CAN_FLAG_ESI;
+	struct gs_host_frame_compact record = {
+		.flags = (frame->flags & (GS_CAN_FLAG_OVERFLOW | (fd ? fd_flags : 0))) |
+				 FIELD_PREP(GS_HOST_FRAME_COMPACT_FLAG_TX_STATUS,
+							gs_host_frame_compact_tx_status(frame->flags)),
+		.channel_dlc = nr << 4 | (frame->can_dlc & 0x0f),
+		.can_id = frame->can_id,
+	};
+	size_t len = sizeof(record);
+
+	if (!ts->valid || delta_us > UINT16_MAX) {
+		record.flags |= GS_HOST_FRAME_COMPACT_FLAG_TS_ABS;
+		memcpy(buf + len, &timestamp_us, sizeof(timestamp_us));
+		len += sizeof(timestamp_us);
+	} else {
+		record.timestamp_delta_us = delta_us;
+	}
+
+	ts->timestamp_us = timestamp_us;
+	ts->valid = true;
+
+	if (frame->echo_id != GS_HOST_FRAME_ECHO_ID_RX) {
+		record.flags |= GS_HOST_FRAME_COMPACT_FLAG_ECHO;
+		memcpy(buf + len, &frame->echo_id, sizeof(frame->echo_id));
+		len += sizeof(frame->echo_id);
+	}
+
+	memcpy(buf, &record, sizeof(record));
+	memcpy(buf + len, frame->classic_can->data, data_len);
+
+	return len + data_len;
+}
+
+// Decode the compact record at the beginning of buf into frame, the
+// reverse of gs_host_frame_compact_encode(), as done by the host.
+// frame must be large enough for a CAN-FD frame with timestamp.
+// timestamp_us holds the timestamp of the previous record of each
+// channel. Return the record's length, or 0 if buf doesn't hold a
+// complete record.
+static inline size_t gs_host_frame_compact_decode(const uint8_t *buf, size_t len,
+												  uint32_t timestamp_us[16],
+												  struct gs_host_frame *frame)
+{
+	struct gs_host_frame_compact record;
+	size_t offset = sizeof(record);
+
+	if (len < offset)
+		return 0;
+
+	memcpy(&record, buf, sizeof(record));
+
+	const bool fd = record.flags & GS_CAN_FLAG_FD;
+	const size_t data_len = can_dlc2len(record.channel_dlc, fd);
+	const size_t record_len = offset + data_len +
+							  (record.flags & GS_HOST_FRAME_COMPACT_FLAG_TS_ABS ? sizeof(u32) : 0) +
+							  (record.flags & GS_HOST_FRAME_COMPACT_FLAG_ECHO ? sizeof(u32) : 0);
+	if (len < record_len)
+		return 0;
+
+	frame->echo_id = GS_HOST_FRAME_ECHO_ID_RX;
+	frame->can_id = record.can_id;
+	frame->can_dlc = record.channel_dlc & 0x0f;
+	frame->channel = record.channel_dlc >> 4;
+	frame->flags = (record.flags & (GS_CAN_FLAG_OVERFLOW | GS_CAN_FLAG_FD |
+									GS_CAN_FLAG_BRS | GS_CAN_FLAG_ESI)) |
+				   gs_host_frame_compact_tx_status_to_flags(FIELD_GET(GS_HOST_FRAME_COMPACT_FLAG_TX_STATUS,
+																	   record.flags));
+	frame->reserved = 0;
+
+	if (record.flags & GS_HOST_FRAME_COMPACT_FLAG_TS_ABS) {
+		memcpy(&timestamp_us[frame->channel], buf + offset, sizeof(u32));
+		offset += sizeof(u32);
+	} else {
+		timestamp_us[frame->channel] += record.timestamp_delta_us;
+	}
+
+	if (record.flags & GS_HOST_FRAME_COMPACT_FLAG_ECHO) {
+		memcpy(&frame->echo_id, buf + offset, sizeof(frame->echo_id));
+		offset += sizeof(frame->echo_id);
+	}
+
+	memcpy(frame->classic_can->data, buf + offset, data_len);
+
+	if (fd)
+		frame->canfd_ts->timestamp_us = timestamp_us[frame->channel];
+	else
+		frame->classic_can_ts->timestamp_us = timestamp_us[frame->channel];
+
+	return record_len;
+}
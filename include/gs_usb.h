@@ -30,10 +30,12 @@
 #include "compiler.h"
 
 #define u32												  uint32_t
+#define u16												  uint16_t
 #define u8												  uint8_t
 
 #define GSUSB_ENDPOINT_IN								  0x81
 #define GSUSB_ENDPOINT_OUT								  0x02
+#define GSUSB_ENDPOINT_STATUS							  0x83
 
 #define GS_CAN_FEATURE_LISTEN_ONLY						  (1<<0)
 #define GS_CAN_FEATURE_LOOP_BACK						  (1<<1)
@@ -88,16 +90,115 @@
  * - struct gs_device_bus_off_recovery
  */
 #define GS_CAN_FEATURE_BUS_OFF_RECOVERY					  (1<<18)
+/* device packs several frames into one bulk IN transfer:
+ * - frames are sent back to back without padding
+ * - each frame has the size given by its flags and the channel's features
+ * - a transfer is at most GS_HOST_FRAME_BATCH_SIZE_MAX bytes long
+ * - a transfer is terminated by a short or zero length packet
+ */
+#define GS_CAN_FEATURE_IN_BATCH							  (1<<19)
+/* device accepts several frames in one bulk OUT transfer:
+ * - frames are sent back to back without padding and without timestamp
+ * - a transfer is at most 4 * wMaxPacketSize of the OUT endpoint bytes long
+ * - the frames of a transfer are either all queued or the OUT
+ *   endpoint NAKs until there is room for all of them
+ * - if other started channels share the endpoint, the frames of a
+ *   channel without room are echoed with GS_CAN_FLAG_TX_ABORTED
+ *   right away instead, so that it doesn't block the other channels
+ * - only a frame for a channel started with this feature may be
+ *   followed by another one, otherwise the rest of the transfer is
+ *   ignored
+ */
+#define GS_CAN_FEATURE_OUT_BATCH						  (1<<20)
+/* device sends and accepts CAN-FD frames trimmed to their DLC:
+ * - the data is cut to the length given by the DLC, padded to a multiple of 4 bytes
+ * - the timestamp (if enabled) directly follows the padded data
+ * - classic CAN frames are not affected
+ */
+#define GS_CAN_FEATURE_FD_DLC_TRIM						  (1<<21)
+/* device doesn't echo transmitted frames back to the host, but only
+ * every Nth one, see:
+ * - GS_USB_BREQ_SET_TX_ECHO_INTERVAL
+ * - struct gs_device_tx_echo_interval
+ * Frames with one of the GS_CAN_FLAG_TX_STATUS flags are always echoed.
+ */
+#define GS_CAN_FEATURE_TX_ECHO_SUPPRESS					  (1<<22)
+/* device sends a struct gs_device_status on the interrupt endpoint
+ * GSUSB_ENDPOINT_STATUS, whenever the status of the channel changes
+ */
+#define GS_CAN_FEATURE_STATUS_EP						  (1<<23)
+/* device has a bulk IN/OUT endpoint pair per channel, channel 0 uses
+ * GSUSB_ENDPOINT_IN/GSUSB_ENDPOINT_OUT, channel n uses
+ * 0x82 + 2 * n/0x03 + 2 * n. If a channel is started with this
+ * feature, its frames are only exchanged over its own pair.
+ */
+#define GS_CAN_FEATURE_CHANNEL_EP						  (1<<24)
+/* device supports the compact frame format, see:
+ * - GS_USB_BREQ_SET_RX_FORMAT
+ * - struct gs_device_rx_format
+ * - struct gs_host_frame_compact
+ */
+#define GS_CAN_FEATURE_RX_FORMAT_COMPACT				  (1<<25)
+/* device limits the frame objects each channel may hold, see:
+ * - GS_USB_BREQ_SET_POOL_QUOTA
+ * - GS_USB_BREQ_GET_POOL_QUOTA
+ * - GS_USB_BREQ_GET_STATS
+ * - GS_USB_BREQ_GET_POOL_INFO
+ * - struct gs_device_pool_quota
+ * - struct gs_device_stats
+ * - struct gs_device_pool_info
+ */
+#define GS_CAN_FEATURE_POOL_QUOTA						  (1<<26)
+/* device transmits the pending frames of a channel in the order of
+ * their CAN arbitration priority instead of in the order they were
+ * received from the host, frames with the same ID stay in order
+ */
+#define GS_CAN_FEATURE_TX_PRIO							  (1<<27)
+/* device replaces a queued frame by a newer one with the same ID, for
+ * the IDs configured with GS_USB_BREQ_SET_TX_COALESCE, see:
+ * - struct gs_device_tx_coalesce
+ * The newer frame takes the place of the replaced one in the queue and
+ * is echoed with its own echo_id once sent. The replaced frame is
+ * echoed right away with GS_CAN_FLAG_TX_ABORTED.
+ */
+#define GS_CAN_FEATURE_TX_COALESCE						  (1<<28)
+/* frames from the host carry a u32 deadline behind their data, in
+ * place of the timestamp of frames to the host. It is the maximum age
+ * in us after the device received the frame or, with
+ * GS_CAN_FLAG_TX_DEADLINE_ABS, the device timestamp it expires at. 0
+ * means no deadline. Expired frames are not sent, but echoed with
+ * GS_CAN_FLAG_TX_EXPIRED.
+ */
+#define GS_CAN_FEATURE_TX_DEADLINE						  (1<<29)
+/* device aborts the pending frames of a started channel on
+ * GS_USB_BREQ_TX_ABORT without leaving the bus, the frames not sent
+ * yet are echoed with GS_CAN_FLAG_TX_ABORTED
+ */
+#define GS_CAN_FEATURE_TX_ABORT							  (1<<30)
 
 #define GS_CAN_FLAG_OVERFLOW							  (1<<0)
 #define GS_CAN_FLAG_FD									  (1<<1) /* is a CAN-FD frame */
 #define GS_CAN_FLAG_BRS									  (1<<2) /* bit rate switch (for CAN-FD frames) */
 #define GS_CAN_FLAG_ESI									  (1<<3) /* error state indicator (for CAN-FD frames) */
+#define GS_CAN_FLAG_TX_DEADLINE_ABS						  (1<<4) /* deadline is absolute (host to device) */
+#define GS_CAN_FLAG_TX_EXPIRED							  (1<<5) /* frame expired, not sent (echo) */
+#define GS_CAN_FLAG_TX_ABORTED							  (1<<6) /* frame aborted, not sent (echo) */
+#define GS_CAN_FLAG_TX_FAILED							  (1<<7) /* transmission failed, e.g. in one-shot mode (echo) */
+
+/* echo flags of frames that were not sent, always echoed. Compact
+ * records carry them as GS_HOST_FRAME_COMPACT_FLAG_TX_STATUS, as only
+ * bits 0...3 are shared with struct gs_host_frame_compact.
+ */
+#define GS_CAN_FLAG_TX_STATUS \
+	(GS_CAN_FLAG_TX_EXPIRED | GS_CAN_FLAG_TX_ABORTED | GS_CAN_FLAG_TX_FAILED)
 
 #define CAN_EFF_FLAG									  0x80000000U /* EFF/SFF is set in the MSB */
 #define CAN_RTR_FLAG									  0x40000000U /* remote transmission request */
 #define CAN_ERR_FLAG									  0x20000000U /* error message frame */
 
+#define CAN_SFF_MASK									  0x000007FFU /* standard frame format (SFF) */
+#define CAN_EFF_MASK									  0x1FFFFFFFU /* extended frame format (EFF) */
+
 #define CAN_ERR_DLC										  8 /* dlc for error message frames */
 
 /* error class (mask) in can_id */
@@ -210,6 +311,14 @@ enum gs_usb_breq {
 	__GS_USB_BREQ_ELM_PLACEHOLDER_30,
 	__GS_USB_BREQ_ELM_PLACEHOLDER_31,
 	GS_USB_BREQ_BUS_OFF_RECOVERY = 32,
+	GS_USB_BREQ_SET_TX_ECHO_INTERVAL,
+	GS_USB_BREQ_SET_RX_FORMAT,
+	GS_USB_BREQ_SET_POOL_QUOTA,
+	GS_USB_BREQ_GET_POOL_QUOTA,
+	GS_USB_BREQ_GET_STATS,
+	GS_USB_BREQ_GET_POOL_INFO,
+	GS_USB_BREQ_SET_TX_COALESCE,
+	GS_USB_BREQ_TX_ABORT,
 };
 
 enum gs_can_mode {
@@ -272,6 +381,15 @@ struct gs_device_state {
 	u32 txerr;
 } __packed __aligned(4);
 
+struct gs_device_status {
+	u8 channel;
+	u8 state;
+	u8 rxerr;
+	u8 txerr;
+	u16 pool_free;        /* free frame objects of the device */
+	u16 from_host_depth;  /* frames queued for transmission on the channel */
+} __packed __aligned(4);
+
 struct gs_device_bittiming {
 	u32 prop_seg;
 	u32 phase_seg1;
@@ -360,6 +478,52 @@ struct gs_device_bus_off_recovery {
 	u32 unused;
 } __packed __aligned(4);
 
+/* echo every interval-th transmitted frame, 0 disables all echoes */
+struct gs_device_tx_echo_interval {
+	u32 interval;
+} __packed __aligned(4);
+
+enum gs_device_rx_format_mode {
+	GS_DEVICE_RX_FORMAT_DEFAULT = 0,	/* struct gs_host_frame */
+	GS_DEVICE_RX_FORMAT_COMPACT,		/* struct gs_host_frame_compact */
+};
+
+struct gs_device_rx_format {
+	u32 format;
+} __packed __aligned(4);
+
+/* frame objects of a channel, counting frames from and to the host */
+struct gs_device_pool_quota {
+	u32 min;	/* classic CAN objects kept free for the started channel */
+	u32 max;	/* objects the channel may hold at most */
+} __packed __aligned(4);
+
+/* per device, the frame pool is sized from the free RAM */
+struct gs_device_pool_info {
+	u32 size;		/* classic CAN frame objects */
+	u32 size_fd;	/* CAN-FD frame objects */
+	u32 ring_size;	/* frames queued for transmission per channel */
+} __packed __aligned(4);
+
+#define GS_DEVICE_TX_COALESCE_MAX 8
+
+/* IDs, including CAN_EFF_FLAG and CAN_RTR_FLAG, of which only the
+ * latest frame is transmitted */
+struct gs_device_tx_coalesce {
+	u32 count;
+	u32 can_id[GS_DEVICE_TX_COALESCE_MAX];
+} __packed __aligned(4);
+
+struct gs_device_stats {
+	u32 pool_used;			/* frame objects held by the channel */
+	u32 pool_quota_hits;	/* frames from the CAN bus dropped due to the quota */
+	u32 rx_dropped;			/* RX frames dropped */
+	u32 err_dropped;		/* error frames dropped */
+	u32 tx_expired;			/* frames from the host discarded due to their deadline */
+	u32 tx_failed;			/* frames from the host that failed on the bus */
+	u32 tx_rejected;		/* frames from the host echoed as aborted as the channel was full */
+} __packed __aligned(4);
+
 struct classic_can {
 	u8 data[8];
 } __packed __aligned(4);
@@ -380,6 +544,44 @@ struct canfd_ts {
 
 #define GS_HOST_FRAME_ECHO_ID_RX 0xffffffff
 
+#define GS_HOST_FRAME_BATCH_SIZE_MAX 512
+
+/* flags of struct gs_host_frame_compact:
+ * - bits 0...3: GS_CAN_FLAG_OVERFLOW, _FD, _BRS and _ESI
+ * - bits 4...5: TX status of an echo, enum gs_host_frame_compact_tx_status
+ * - bit 6: GS_HOST_FRAME_COMPACT_FLAG_TS_ABS
+ * - bit 7: GS_HOST_FRAME_COMPACT_FLAG_ECHO
+ */
+#define GS_HOST_FRAME_COMPACT_FLAG_TX_STATUS (0x3<<4)
+#define GS_HOST_FRAME_COMPACT_FLAG_TS_ABS	 (1<<6) /* u32 timestamp_us follows */
+#define GS_HOST_FRAME_COMPACT_FLAG_ECHO		 (1<<7) /* u32 echo_id follows */
+
+enum gs_host_frame_compact_tx_status {
+	GS_HOST_FRAME_COMPACT_TX_OK = 0,
+	GS_HOST_FRAME_COMPACT_TX_EXPIRED,	/* GS_CAN_FLAG_TX_EXPIRED */
+	GS_HOST_FRAME_COMPACT_TX_ABORTED,	/* GS_CAN_FLAG_TX_ABORTED */
+	GS_HOST_FRAME_COMPACT_TX_FAILED,	/* GS_CAN_FLAG_TX_FAILED */
+};
+
+/*
+ * Compact frame record, sent device -> host by channels switched to
+ * GS_DEVICE_RX_FORMAT_COMPACT. Records are packed back to back
+ * without padding:
+ * - struct gs_host_frame_compact
+ * - u32 timestamp_us, if GS_HOST_FRAME_COMPACT_FLAG_TS_ABS
+ * - u32 echo_id, if GS_HOST_FRAME_COMPACT_FLAG_ECHO
+ * - data, length given by the DLC
+ *
+ * Without GS_HOST_FRAME_COMPACT_FLAG_TS_ABS the timestamp is the one of
+ * the previous record of the channel plus timestamp_delta_us.
+ */
+struct gs_host_frame_compact {
+	u8 flags;
+	u8 channel_dlc;			/* channel << 4 | can_dlc */
+	u16 timestamp_delta_us;
+	u32 can_id;
+} __packed;
+
 struct gs_host_frame {
 	u32 echo_id;
 	u32 can_id;
@@ -25,8 +25,12 @@
 
 #pragma once
 
+#include <string.h>
+
 #include "can.h"
+#include "can_common.h"
 #include "config.h"
+#include "gs_host_frame_compact.h"
 #include "usbd_gs_can.h"
 
 static inline uint8_t
@@ -47,23 +51,292 @@ gs_host_frame_object_get_channel(USBD_GS_CAN_HandleTypeDef *hcan,
 	return &hcan->channels[channel_nr];
 }
 
+// Frame objects are numbered, classic ones first, so that they can
+// be referenced by a small index.
+static inline struct gs_host_frame_object *
+gs_host_frame_object_from_idx(USBD_GS_CAN_HandleTypeDef *hcan, unsigned int idx)
+{
+#ifdef CONFIG_CANFD
+	if (idx >= hcan->msgbuf_count)
+		return &hcan->msgbuf_fd[idx - hcan->msgbuf_count];
+#endif
+
+	return (struct gs_host_frame_object *)&hcan->msgbuf[idx];
+}
+
+// Return true if frame_object is big enough for CAN-FD frames.
+static inline bool
+gs_host_frame_object_is_fd(const USBD_GS_CAN_HandleTypeDef __maybe_unused *hcan,
+						   const struct gs_host_frame_object __maybe_unused *frame_object)
+{
+#ifdef CONFIG_CANFD
+	return frame_object >= hcan->msgbuf_fd &&
+		   frame_object < hcan->msgbuf_fd + hcan->msgbuf_fd_count;
+#else
+	return false;
+#endif
+}
+
+static inline unsigned int
+gs_host_frame_object_to_idx(const USBD_GS_CAN_HandleTypeDef *hcan,
+							const struct gs_host_frame_object *frame_object)
+{
+#ifdef CONFIG_CANFD
+	if (gs_host_frame_object_is_fd(hcan, frame_object))
+		return hcan->msgbuf_count + (frame_object - hcan->msgbuf_fd);
+#endif
+
+	return (const struct gs_host_frame_object_classic *)frame_object - hcan->msgbuf;
+}
+
+static inline bool gs_host_frame_is_fd(const struct gs_host_frame *frame)
+{
+	return IS_ENABLED(CONFIG_CANFD) && frame->flags & GS_CAN_FLAG_FD;
+}
+
+// Pool of the frame objects for CAN-FD or classic CAN frames.
+static inline struct gs_host_frame_pool *
+gs_host_frame_pool_select(USBD_GS_CAN_HandleTypeDef *hcan, bool __maybe_unused fd)
+{
+#ifdef CONFIG_CANFD
+	if (fd)
+		return &hcan->frame_pool_fd;
+#endif
+
+	return &hcan->frame_pool;
+}
+
+// Number of frame objects of both pools.
+static inline unsigned int gs_host_frame_pool_size(const USBD_GS_CAN_HandleTypeDef *hcan)
+{
+	unsigned int size = hcan->msgbuf_count;
+
+#ifdef CONFIG_CANFD
+	size += hcan->msgbuf_fd_count;
+#endif
+
+	return size;
+}
+
+// Carve the frame objects from the RAM between start and end.
+static inline void gs_host_frame_pool_init(USBD_GS_CAN_HandleTypeDef *hcan,
+										   uint8_t *start, uint8_t *end)
+{
+#ifdef CONFIG_CANFD
+	// Most traffic is classic CAN even on CAN-FD buses, so spend only
+	// a quarter of the RAM on CAN-FD objects and fill the rest with
+	// the smaller classic ones.
+	hcan->msgbuf_fd = (struct gs_host_frame_object *)start;
+	hcan->msgbuf_fd_count = (size_t)(end - start) / 4 / sizeof(*hcan->msgbuf_fd);
+	start += hcan->msgbuf_fd_count * sizeof(*hcan->msgbuf_fd);
+#endif
+	hcan->msgbuf = (struct gs_host_frame_object_classic *)start;
+	hcan->msgbuf_count = (size_t)(end - start) / sizeof(*hcan->msgbuf);
+
+	// Frame objects are referenced by a frame_ring_idx_t and counted
+	// in 16 bit wide fields.
+	hcan->msgbuf_count = MIN(hcan->msgbuf_count,
+							 UINT16_MAX - (gs_host_frame_pool_size(hcan) - hcan->msgbuf_count));
+
+	INIT_LIST_HEAD(&hcan->frame_pool.list);
+	hcan->frame_pool.free = 0;
+#ifdef CONFIG_CANFD
+	INIT_LIST_HEAD(&hcan->frame_pool_fd.list);
+	hcan->frame_pool_fd.free = 0;
+#endif
+
+	for (unsigned int i = 0; i < gs_host_frame_pool_size(hcan); i++) {
+		struct gs_host_frame_object *frame_object = gs_host_frame_object_from_idx(hcan, i);
+		struct gs_host_frame_pool *pool =
+			gs_host_frame_pool_select(hcan, gs_host_frame_object_is_fd(hcan, frame_object));
+
+		list_add_tail(&frame_object->list, &pool->list);
+		pool->free++;
+	}
+}
+
+// Number of free frame objects of both pools.
+static inline unsigned int gs_host_frame_pool_free(const USBD_GS_CAN_HandleTypeDef *hcan)
+{
+	unsigned int free = hcan->frame_pool.free;
+
+#ifdef CONFIG_CANFD
+	free += hcan->frame_pool_fd.free;
+#endif
+
+	return free;
+}
+
+// The last GS_HOST_FRAME_POOL_RESERVE objects of the classic pool are
+// only handed out by gs_host_frame_object_get_reserved_locked(), so
+// that each channel can report an overflow to the host.
+#define GS_HOST_FRAME_POOL_RESERVE NUM_CAN_CHANNEL
+
+// Default quota: a quarter of the classic objects is evenly kept free
+// for the started channels, so that a stuck channel can't starve the
+// others.
+static inline unsigned int
+gs_host_frame_pool_quota_min(const USBD_GS_CAN_HandleTypeDef *hcan)
+{
+	if (NUM_CAN_CHANNEL == 1)
+		return 0;
+
+	return hcan->msgbuf_count / (4 * NUM_CAN_CHANNEL);
+}
+
+// pool_used and the quota are 16 bit wide
+#define GS_HOST_FRAME_POOL_QUOTA_MAX UINT16_MAX
+
+static inline unsigned int gs_host_frame_pool_reserve(bool fd)
+{
+	return fd ? 0 : GS_HOST_FRAME_POOL_RESERVE;
+}
+
+// Classic objects kept free for the minimum quota of the other
+// started channels. Must be called with IRQ disabled.
+static inline unsigned int
+gs_host_frame_pool_headroom(const USBD_GS_CAN_HandleTypeDef *hcan, const can_data_t *channel)
+{
+	unsigned int headroom = 0;
+
+	if (NUM_CAN_CHANNEL == 1)
+		return 0;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan->channels); i++) {
+		const can_data_t *other = &hcan->channels[i];
+
+		if (other == channel || !can_is_enabled(other))
+			continue;
+
+		if (other->pool_used < other->pool_quota_min)
+			headroom += other->pool_quota_min - other->pool_used;
+	}
+
+	return headroom;
+}
+
+// Return frame_object to its pool. Must be called with IRQ disabled.
+static inline void gs_host_frame_object_put(USBD_GS_CAN_HandleTypeDef *hcan,
+											struct gs_host_frame_object *frame_object)
+{
+	const bool fd = gs_host_frame_object_is_fd(hcan, frame_object);
+	struct gs_host_frame_pool *pool = gs_host_frame_pool_select(hcan, fd);
+
+	gs_host_frame_object_get_channel(hcan, frame_object)->pool_used--;
+
+	list_add_tail(&frame_object->list, &pool->list);
+	pool->free++;
+}
+
+static inline void gs_host_frame_object_put_locked(USBD_GS_CAN_HandleTypeDef *hcan,
+												   struct gs_host_frame_object *frame_object)
+{
+	bool was_irq_enabled = disable_irq();
+	gs_host_frame_object_put(hcan, frame_object);
+	restore_irq(was_irq_enabled);
+}
+
+// Return all frame objects of list to their pools and empty list.
+// Must be called with IRQ disabled.
+static inline void gs_host_frame_object_put_list(USBD_GS_CAN_HandleTypeDef *hcan,
+												 struct list_head *list)
+{
+	struct gs_host_frame_object *iter, *next;
+
+	list_for_each_entry_safe(iter, next, list, list) {
+		gs_host_frame_object_put(hcan, iter);
+	}
+
+	INIT_LIST_HEAD(list);
+}
+
+static inline void gs_host_frame_object_put_list_locked(USBD_GS_CAN_HandleTypeDef *hcan,
+														struct list_head *list)
+{
+	bool was_irq_enabled = disable_irq();
+	gs_host_frame_object_put_list(hcan, list);
+	restore_irq(was_irq_enabled);
+}
+
+// Take a frame object for channel from the pool, leaving reserve
+// objects. With quota, the channel's maximum and the other channels'
+// minimum quotas are honored as well. The object is accounted to
+// channel until it is returned by gs_host_frame_object_put().
+// Must be called with IRQ disabled.
+static inline struct gs_host_frame_object *
+__gs_host_frame_object_get(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel,
+						   bool fd, unsigned int reserve, bool quota)
+{
+	struct gs_host_frame_pool *pool = gs_host_frame_pool_select(hcan, fd);
+	struct gs_host_frame_object *frame_object;
+
+	if (quota) {
+		if (channel->pool_used >= channel->pool_quota_max)
+			return NULL;
+
+		if (!fd)
+			reserve += gs_host_frame_pool_headroom(hcan, channel);
+	}
+
+	if (pool->free <= reserve)
+		return NULL;
+
+	frame_object = list_first_entry(&pool->list,
+									struct gs_host_frame_object,
+									list);
+
+	list_del(&frame_object->list);
+	pool->free--;
+
+	channel->pool_used++;
+	frame_object->frame.channel = can_channel_get_nr(channel);
+
+	return frame_object;
+}
+
+// Number of the pipe the frames of channel are sent to the host over.
+static inline unsigned int gs_host_frame_to_host_pipe_nr(const can_data_t *channel)
+{
+	if (USBD_GS_CAN_NUM_PIPES > 1 &&
+		channel->feature & GS_CAN_FEATURE_CHANNEL_EP)
+		return can_channel_get_nr(channel);
+
+	return 0;
+}
+
+// Get a frame object for a CAN-FD or classic CAN frame of channel.
+// Failures caused by the channel's quota are counted.
 static inline
 struct gs_host_frame_object *
-gs_host_frame_object_get_locked(USBD_GS_CAN_HandleTypeDef *hcan)
+gs_host_frame_object_get_locked(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel, bool fd)
 {
+	const unsigned int reserve = gs_host_frame_pool_reserve(fd);
 	struct gs_host_frame_object *frame_object;
 
 	bool was_irq_enabled = disable_irq();
-	frame_object = list_first_entry_or_null(&hcan->list_frame_pool,
-											struct gs_host_frame_object,
-											list);
-	if (!frame_object) {
-		restore_irq(was_irq_enabled);
-		return NULL;
-	}
+	frame_object = __gs_host_frame_object_get(hcan, channel, fd, reserve, true);
+	if (!frame_object && gs_host_frame_pool_select(hcan, fd)->free > reserve)
+		channel->pool_quota_hits++;
+	restore_irq(was_irq_enabled);
 
-	list_del(&frame_object->list);
+	return frame_object;
+}
+
+// Get a frame object for a classic CAN frame of channel, including the
+// reserve and regardless of the quota.
+static inline
+struct gs_host_frame_object *
+gs_host_frame_object_get_reserved_locked(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	bool was_irq_enabled = disable_irq();
+	struct gs_host_frame_object *frame_object =
+		__gs_host_frame_object_get(hcan, channel, false, 0, false);
 	restore_irq(was_irq_enabled);
 
 	return frame_object;
 }
+
+static inline size_t gs_host_frame_data_len(const struct gs_host_frame *frame)
+{
+	return can_dlc2len(frame->can_dlc, gs_host_frame_is_fd(frame));
+}
@@ -43,28 +43,47 @@
 #else
 #define CAN_DATA_MAX_PACKET_SIZE 32    /* Endpoint IN & OUT Packet size */
 #endif
-#define USB_CAN_CONFIG_DESC_SIZ	 50
+#ifdef CONFIG_USB_EP_PER_CHANNEL
+#define USBD_GS_CAN_NUM_PIPES	 NUM_CAN_CHANNEL
+#else
+#define USBD_GS_CAN_NUM_PIPES	 1
+#endif
+#define USB_CAN_CONFIG_DESC_SIZ	 (57 + 14 * (USBD_GS_CAN_NUM_PIPES - 1))
 #define USBD_GS_CAN_VENDOR_CODE	 0x20
 #define DFU_INTERFACE_NUM		 1
 #define DFU_INTERFACE_STR_INDEX	 0xE0
 
 extern USBD_ClassTypeDef USBD_GS_CAN;
 
+#define GS_HOST_FRAME_CLASSIC_SIZE struct_size((struct gs_host_frame *)NULL, classic_can_ts, 1)
 #ifdef CONFIG_CANFD
 #define GS_HOST_FRAME_SIZE struct_size((struct gs_host_frame *)NULL, canfd_ts, 1)
 #else
-#define GS_HOST_FRAME_SIZE struct_size((struct gs_host_frame *)NULL, classic_can_ts, 1)
+#define GS_HOST_FRAME_SIZE GS_HOST_FRAME_CLASSIC_SIZE
 #endif
 
+/* Size of the buffer used to pack several frames into one IN transfer */
+#define USBD_GS_CAN_IN_BATCH_SIZE  (8 * CAN_DATA_MAX_PACKET_SIZE)
+/* Size of the buffer(s) OUT transfers are received into */
+#define USBD_GS_CAN_OUT_BATCH_SIZE (4 * CAN_DATA_MAX_PACKET_SIZE)
+
 // When using double buffer for RX, this needs to be at least 2 to
 // ensure there is always an RX buffer ready to receive the
-// RX frames.
+// RX transfers, even if the frame pool is exhausted.
 #if defined(USB) || defined(USB_DRD_FS)
 #define USBD_GS_CAN_RX_BUFFER_COUNT 2
 #else
 #define USBD_GS_CAN_RX_BUFFER_COUNT 1
 #endif
 
+/*
+ * Endpoints of a pipe, pipe 0 uses GSUSB_ENDPOINT_IN and
+ * GSUSB_ENDPOINT_OUT, with CONFIG_USB_EP_PER_CHANNEL each further
+ * channel has its own pipe.
+ */
+#define USBD_GS_CAN_EP_IN(nr)  ((nr) ? 0x82 + 2 * (nr) : GSUSB_ENDPOINT_IN)
+#define USBD_GS_CAN_EP_OUT(nr) ((nr) ? 0x03 + 2 * (nr) : GSUSB_ENDPOINT_OUT)
+
 struct gs_host_frame_object {
 	struct list_head list;
 	union {
@@ -73,12 +92,51 @@ struct gs_host_frame_object {
 	};
 };
 
+/* same layout as struct gs_host_frame_object, but only for classic CAN frames */
+struct gs_host_frame_object_classic {
+	struct list_head list;
+	union {
+		uint8_t _buf[GS_HOST_FRAME_CLASSIC_SIZE];
+		struct gs_host_frame frame;
+	};
+};
+
+/* free frame objects of one size */
+struct gs_host_frame_pool {
+	struct list_head list;
+	unsigned int free;
+};
+
+/* transfer buffers of a bulk IN/OUT endpoint pair, kept out of the
+ * handle, so that they stay in main SRAM if the handle is placed in
+ * core coupled memory, which is not reachable by DMA
+ */
+struct usbd_gs_can_pipe_buf {
+	uint8_t __aligned(4) to_host_batch[USBD_GS_CAN_IN_BATCH_SIZE];
+	uint8_t __aligned(4) from_host_batch[USBD_GS_CAN_RX_BUFFER_COUNT][USBD_GS_CAN_OUT_BATCH_SIZE];
+};
+
+/* state of a bulk IN/OUT endpoint pair */
+struct usbd_gs_can_pipe {
+	uint8_t to_host_next;	/* channel whose turn it is */
+	uint16_t from_host_batch_len[USBD_GS_CAN_RX_BUFFER_COUNT];
+	uint8_t from_host_batch_head;
+	uint8_t from_host_batch_pending;
+	struct gs_host_frame_object *to_host_buf;
+	uint16_t to_host_len;	/* length of the current IN transfer, if it may need a ZLP */
+	bool to_host_zlp;
+
+	struct usbd_gs_can_pipe_buf *buf;
+};
+
 typedef struct {
 	union ep0 {
 		struct_group_tagged(ep0_data, data, union {
 			// Device -> Host
 			struct dfu_status dfu_status;
 			struct gs_device_state state;
+			struct gs_device_stats stats;
+			struct gs_device_pool_info pool_info;
 
 			// Host -> Device
 			const struct gs_host_config config;
@@ -86,36 +144,49 @@ typedef struct {
 			const struct gs_device_mode mode;
 			const struct gs_identify_mode identify_mode;
 			const struct gs_device_filter filter;
+			const struct gs_device_tx_echo_interval tx_echo_interval;
+			const struct gs_device_rx_format rx_format;
+			const struct gs_device_tx_coalesce tx_coalesce;
 
 			// Device <-> Host
 			struct gs_device_termination_state term_state;
 			struct gs_device_tdc tdc;
+			struct gs_device_pool_quota pool_quota;
 		}; );
 		uint8_t __aligned(4) buf[sizeof(struct ep0_data)];
 	} ep0;
 
 	USBD_SetupReqTypedef last_setup_request;
 
-	struct list_head list_frame_pool;
-	struct list_head list_to_host;
-
-	struct gs_host_frame_object *from_host_buf[USBD_GS_CAN_RX_BUFFER_COUNT];
-	struct gs_host_frame_object *to_host_buf;
+	struct gs_host_frame_pool frame_pool;
+#ifdef CONFIG_CANFD
+	struct gs_host_frame_pool frame_pool_fd;
+#endif
 
 	can_data_t channels[NUM_CAN_CHANNEL];
 
 	uint32_t sof_timestamp_us;
 
-	struct gs_host_frame_object msgbuf[CAN_QUEUE_SIZE];
+	// last status sent per channel, the one in flight must not be modified
+	struct gs_device_status status[NUM_CAN_CHANNEL];
+	uint32_t status_tick;
+	uint8_t status_next;
+	bool status_busy;
+
+	// carved from the free RAM by gs_host_frame_pool_init()
+	struct gs_host_frame_object_classic *msgbuf;
+	unsigned int msgbuf_count;
+#ifdef CONFIG_CANFD
+	struct gs_host_frame_object *msgbuf_fd;
+	unsigned int msgbuf_fd_count;
+#endif
+	struct usbd_gs_can_pipe pipe[USBD_GS_CAN_NUM_PIPES];
 
 	bool dfu_detach_requested;
 } USBD_GS_CAN_HandleTypeDef __attribute__ ((aligned (4)));
 
-void usbd_gs_can_purge_from_host_list_by_channel(USBD_GS_CAN_HandleTypeDef *hcan,
-												 struct can_channel *channel);
-
 void usbd_gs_can_purge_to_host_list_by_channel(USBD_GS_CAN_HandleTypeDef *hcan,
-											   const struct can_channel *channel);
+											   struct can_channel *channel);
 
 #if defined(STM32F0)
 # define USB_INTERFACE USB
@@ -138,6 +209,7 @@ void USBD_GS_CAN_SuspendCallback(USBD_HandleTypeDef *pdev);
 void USBD_GS_CAN_ResumeCallback(USBD_HandleTypeDef *pdev);
 void USBD_GS_CAN_ReceiveFromHost(USBD_HandleTypeDef *pdev);
 void USBD_GS_CAN_SendToHost(USBD_HandleTypeDef *pdev);
+void USBD_GS_CAN_SendStatus(USBD_HandleTypeDef *pdev);
 bool USBD_GS_CAN_CustomDeviceRequest(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
 bool USBD_GS_CAN_CustomInterfaceRequest(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
 
@@ -0,0 +1,145 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+
+#include "benchmark.h"
+#include "compiler.h"
+#include "config.h"
+#include "frame_ring.h"
+#include "hal_include.h"
+#include "list.h"
+#include "util.h"
+
+#define BENCHMARK_LOOPS 16
+
+struct benchmark_result benchmark_result;
+
+#ifdef DWT
+
+struct benchmark_entry {
+	struct list_head list;
+};
+
+static struct frame_ring benchmark_ring;
+static struct benchmark_entry benchmark_entry[FRAME_RING_SIZE];
+
+static inline uint32_t benchmark_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+// Average cycles of a single operation, per FRAME_RING_SIZE
+// operations in a row, as done by the producer and consumer.
+static uint32_t benchmark_avg(uint32_t cycles)
+{
+	return cycles / (BENCHMARK_LOOPS * FRAME_RING_SIZE);
+}
+
+static void benchmark_frame_ring(void)
+{
+	struct frame_ring *ring = &benchmark_ring;
+	uint32_t push = 0, pop = 0;
+
+	frame_ring_init(ring);
+
+	for (unsigned int l = 0; l < BENCHMARK_LOOPS; l++) {
+		uint32_t start = benchmark_cycles();
+		for (unsigned int i = 0; i < FRAME_RING_SIZE; i++)
+			frame_ring_push(ring, i);
+		push += benchmark_cycles() - start;
+
+		start = benchmark_cycles();
+		for (unsigned int i = 0; i < FRAME_RING_SIZE; i++) {
+			frame_ring_idx_t idx;
+
+			if (!frame_ring_peek(ring, &idx))
+				break;
+			frame_ring_pop(ring);
+		}
+		pop += benchmark_cycles() - start;
+	}
+
+	benchmark_result.frame_ring_push = benchmark_avg(push);
+	benchmark_result.frame_ring_pop = benchmark_avg(pop);
+}
+
+// The list with IRQ disabled, as used between the USB IRQ and the
+// main loop before the ring.
+static void benchmark_list(void)
+{
+	uint32_t add = 0, del = 0;
+	LIST_HEAD(list);
+
+	for (unsigned int l = 0; l < BENCHMARK_LOOPS; l++) {
+		uint32_t start = benchmark_cycles();
+		for (unsigned int i = 0; i < FRAME_RING_SIZE; i++) {
+			bool was_irq_enabled = disable_irq();
+			list_add_tail(&benchmark_entry[i].list, &list);
+			restore_irq(was_irq_enabled);
+		}
+		add += benchmark_cycles() - start;
+
+		start = benchmark_cycles();
+		for (unsigned int i = 0; i < FRAME_RING_SIZE; i++) {
+			bool was_irq_enabled = disable_irq();
+			struct benchmark_entry *entry =
+				list_first_entry_or_null(&list, struct benchmark_entry, list);
+			if (entry)
+				list_del(&entry->list);
+			restore_irq(was_irq_enabled);
+		}
+		del += benchmark_cycles() - start;
+	}
+
+	benchmark_result.list_add = benchmark_avg(add);
+	benchmark_result.list_del = benchmark_avg(del);
+}
+
+void benchmark_run(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	benchmark_frame_ring();
+	benchmark_list();
+
+	if (IS_ENABLED(CONFIG_SEMIHOSTING))
+		printf("cycles: frame_ring push %lu pop %lu, list add %lu del %lu\n",
+			   (unsigned long)benchmark_result.frame_ring_push,
+			   (unsigned long)benchmark_result.frame_ring_pop,
+			   (unsigned long)benchmark_result.list_add,
+			   (unsigned long)benchmark_result.list_del);
+}
+
+#else
+
+// Cortex-M0(+) has no cycle counter.
+void benchmark_run(void)
+{
+}
+
+#endif
@@ -47,6 +47,7 @@ const struct gs_device_bt_const CAN_btconst = {
 		(IS_ENABLED(CONFIG_CAN_FILTER) ?
 		 GS_CAN_FEATURE_FILTER : 0) |
 		GS_CAN_FEATURE_BUS_OFF_RECOVERY |
+		GS_CAN_FEATURE_FIRMWARE_COMMON |
 		0,
 	.fclk_can = CAN_CLOCK_SPEED,
 	.btc = {
@@ -91,16 +92,183 @@ static void rcc_reset(CAN_TypeDef *instance)
 #endif
 }
 
+#if defined(STM32F0)
+#define BXCAN_RX_IRQn CEC_CAN_IRQn
+#elif defined(STM32F4)
+#define BXCAN_RX_IRQn CAN1_RX0_IRQn
+#define BXCAN_RX1_IRQn CAN1_RX1_IRQn
+#define BXCAN_TX_IRQn CAN1_TX_IRQn
+#endif
+
+static can_data_t *bxcan_channels[NUM_CAN_CHANNEL];
+
 void can_init(can_data_t *channel, const struct board_channel_config *channel_config)
 {
 	struct gs_device_filter_bxcan *filter = &channel->filter.bxcan;
 
 	device_can_init(channel, channel_config);
 
-	filter->fs1r = 0x1;     // 32-bit for filter bank 0
-	filter->fm1r = 0x0;     // Mask mode for filter 0
-	filter->ffa1r = 0x0;    // Assign to FIFO 0
-	filter->fa1r = 0x1;     // Enable filter bank 0
+	/*
+	 * Split the frames by the LSB of their (base) ID, bit 21 of the
+	 * filter registers for standard and extended frames, across
+	 * both RX FIFOs for twice the hardware buffering.
+	 */
+	filter->fs1r = 0x3;     // 32-bit for filter banks 0 and 1
+	filter->fm1r = 0x0;     // Mask mode for filters 0 and 1
+	filter->ffa1r = 0x2;    // Assign filter 0 to FIFO 0, 1 to FIFO 1
+	filter->fa1r = 0x3;     // Enable filter banks 0 and 1
+	filter->fr1[0] = 0;
+	filter->fr2[0] = BIT(21);
+	filter->fr1[1] = BIT(21);
+	filter->fr2[1] = BIT(21);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(bxcan_channels); i++) {
+		if (!bxcan_channels[i]) {
+			bxcan_channels[i] = channel;
+			break;
+		}
+	}
+
+	// Above the USB interrupt, the RX FIFO is only 3 frames deep.
+	HAL_NVIC_SetPriority(BXCAN_RX_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(BXCAN_RX_IRQn);
+#ifdef BXCAN_RX1_IRQn
+	HAL_NVIC_SetPriority(BXCAN_RX1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(BXCAN_RX1_IRQn);
+#endif
+#ifdef BXCAN_TX_IRQn
+	HAL_NVIC_SetPriority(BXCAN_TX_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(BXCAN_TX_IRQn);
+#endif
+}
+
+// Return the RX FIFO holding the oldest frame, by the time stamp of
+// its start of frame, or -1 if both are empty.
+static int bxcan_rx_fifo_next(const CAN_TypeDef *can)
+{
+	const bool pending0 = can->RF0R & CAN_RF0R_FMP0;
+	const bool pending1 = can->RF1R & CAN_RF1R_FMP1;
+
+	if (pending0 && pending1) {
+		const uint16_t time0 = FIELD_GET(CAN_RDT0R_TIME, can->sFIFOMailBox[0].RDTR);
+		const uint16_t time1 = FIELD_GET(CAN_RDT1R_TIME, can->sFIFOMailBox[1].RDTR);
+
+		return (int16_t)(time1 - time0) < 0 ? 1 : 0;
+	}
+
+	if (pending0)
+		return 0;
+
+	if (pending1)
+		return 1;
+
+	return -1;
+}
+
+// Convert the start of frame time stamp of a received frame, in CAN
+// bit times, to the time of timer_get(). The frames must be passed in
+// the order they were received. A new base is taken, if the frame is later than
+// half the 16 bit time stamp period after the base, or if it would be
+// time stamped in the future, i.e. the base was drained late.
+static uint32_t bxcan_rx_time_to_us(can_data_t *channel, uint16_t time)
+{
+	struct bxcan_rx_time *rx_time = &channel->rx_time;
+	const uint32_t now = timer_get();
+
+	if (rx_time->valid && now - rx_time->base_us < 0x8000 * rx_time->bit_time_q4 >> 4) {
+		const uint16_t bits = time - rx_time->base_time;
+		const uint32_t timestamp_us = rx_time->base_us + (bits * rx_time->bit_time_q4 >> 4);
+
+		if ((int32_t)(now - timestamp_us) >= 0)
+			return timestamp_us;
+	}
+
+	rx_time->base_us = now;
+	rx_time->base_time = time;
+	rx_time->valid = true;
+
+	return now;
+}
+
+// Move the frames of both RX FIFOs to the channel's rx_ring, in the
+// order they were received. If the ring is full, drop them, the
+// interrupt would fire again otherwise.
+static void bxcan_rx_drain(can_data_t *channel)
+{
+	CAN_TypeDef *can = channel->instance;
+	struct bxcan_rx_ring *ring = &channel->rx_ring;
+	int nr;
+
+	while ((nr = bxcan_rx_fifo_next(can)) >= 0) {
+		const unsigned int head = ring->head;
+
+		if (head - ring->tail < ARRAY_SIZE(ring->buf)) {
+			const CAN_FIFOMailBox_TypeDef *fifo = &can->sFIFOMailBox[nr];
+			struct bxcan_rx_mailbox *mb = &ring->buf[head % ARRAY_SIZE(ring->buf)];
+
+			mb->rir = fifo->RIR;
+			mb->rdtr = fifo->RDTR;
+			mb->timestamp_us = bxcan_rx_time_to_us(channel, FIELD_GET(CAN_RDT0R_TIME, mb->rdtr));
+			mb->rdlr = fifo->RDLR;
+			mb->rdhr = fifo->RDHR;
+
+			__DMB();
+			ring->head = head + 1;
+		} else {
+			ring->dropped++;
+		}
+
+		// release FIFO
+		if (nr == 0)
+			can->RF0R |= CAN_RF0R_RFOM0;
+		else
+			can->RF1R |= CAN_RF1R_RFOM1;
+	}
+}
+
+// Record the time stamp and the result of the completed TX
+// mailboxes, for can_drv_tx_status().
+static void bxcan_tx_complete(can_data_t *channel)
+{
+	CAN_TypeDef *can = channel->instance;
+	const uint32_t tsr = can->TSR;
+	const uint32_t now = timer_get();
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(channel->tx_mailbox); i++) {
+		struct bxcan_tx_mailbox *mb = &channel->tx_mailbox[i];
+		const unsigned int shift = 8 * i;
+
+		if (!(tsr & CAN_TSR_RQCP0 << shift))
+			continue;
+
+		mb->timestamp_us = now;
+		__DMB();
+
+		// ALST and TERR stay set from a lost or failed attempt
+		// while the mailbox retries, so an aborted frame may have
+		// them, too.
+		if (tsr & CAN_TSR_TXOK0 << shift)
+			mb->status = CAN_DRV_TX_OK;
+		else if (channel->tx_cancel & BIT(i))
+			mb->status = CAN_DRV_TX_ABORTED;
+		else if (tsr & (CAN_TSR_ALST0 | CAN_TSR_TERR0) << shift)
+			mb->status = CAN_DRV_TX_FAILED;
+		else
+			mb->status = CAN_DRV_TX_ABORTED;
+
+		// clear RQCP, TXOK, ALST and TERR
+		can->TSR = CAN_TSR_RQCP0 << shift;
+	}
+}
+
+void CAN_Handler(void)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(bxcan_channels); i++) {
+		if (bxcan_channels[i]) {
+			bxcan_rx_drain(bxcan_channels[i]);
+			bxcan_tx_complete(bxcan_channels[i]);
+		}
+	}
 }
 
 #ifdef CONFIG_CAN_FILTER
@@ -146,7 +314,9 @@ void can_drv_enable(struct can_channel *channel)
 	const uint32_t feature = channel->feature;
 	CAN_TypeDef *can = channel->instance;
 
-	uint32_t mcr = CAN_MCR_INRQ | CAN_MCR_TXFP;
+	// TTCM time stamps the received frames in CAN bit times, to
+	// drain both RX FIFOs in order and for the RX time stamps.
+	uint32_t mcr = CAN_MCR_INRQ | CAN_MCR_TXFP | CAN_MCR_TTCM;
 
 	if (feature & GS_CAN_FEATURE_ONE_SHOT) {
 		mcr |= CAN_MCR_NART;
@@ -181,6 +351,24 @@ void can_drv_enable(struct can_channel *channel)
 
 	can_apply_filter(channel);
 
+	for (unsigned int i = 0; i < ARRAY_SIZE(channel->tx_mailbox); i++)
+		channel->tx_mailbox[i].status = CAN_DRV_TX_IDLE;
+	channel->tx_cancel = 0;
+
+	// empty the RX ring, the reset above has masked the interrupts
+	channel->rx_ring.head = 0;
+	channel->rx_ring.tail = 0;
+	channel->rx_ring.dropped = 0;
+	channel->rx_ring.dropped_seen = 0;
+
+	channel->rx_time.valid = false;
+	channel->rx_time.bit_time_q4 =
+		channel->bittiming.brp *
+		(1 + channel->bittiming.prop_seg + channel->bittiming.phase_seg1 + channel->bittiming.phase_seg2) *
+		16 / (CAN_CLOCK_SPEED / 1000000);
+
+	can->IER = CAN_IER_FMPIE0 | CAN_IER_FMPIE1 | CAN_IER_TMEIE;
+
 	can->MCR &= ~CAN_MCR_INRQ;
 	while ((can->MSR & CAN_MSR_INAK) != 0);
 }
@@ -189,49 +377,62 @@ void can_drv_disable(struct can_channel *channel)
 {
 	CAN_TypeDef *can = channel->instance;
 
+	can->IER = 0;
 	can->MCR |= CAN_MCR_INRQ;     // send can controller into initialization mode
 }
 
 bool can_is_rx_pending(can_data_t *channel)
 {
-	CAN_TypeDef *can = channel->instance;
+	const struct bxcan_rx_ring *ring = &channel->rx_ring;
 
-	return ((can->RF0R & CAN_RF0R_FMP0) != 0);
+	return ring->head != ring->tail;
 }
 
 bool can_receive(can_data_t *channel, struct gs_host_frame *rx_frame)
 {
-	CAN_TypeDef *can = channel->instance;
+	struct bxcan_rx_ring *ring = &channel->rx_ring;
+
+	if (ring->dropped != ring->dropped_seen) {
+		const uint32_t dropped = ring->dropped;
+
+		channel->rx_dropped += dropped - ring->dropped_seen;
+		channel->rx_overflow = true;
+		ring->dropped_seen = dropped;
+	}
 
 	if (can_is_rx_pending(channel)) {
-		CAN_FIFOMailBox_TypeDef *fifo = &can->sFIFOMailBox[0];
+		const unsigned int tail = ring->tail;
+
+		__DMB();
+		const struct bxcan_rx_mailbox *mb = &ring->buf[tail % ARRAY_SIZE(ring->buf)];
 
-		rx_frame->classic_can_ts->timestamp_us = timer_get();
+		rx_frame->classic_can_ts->timestamp_us = mb->timestamp_us;
 
-		if (fifo->RIR &  CAN_RI0R_IDE) {
-			rx_frame->can_id = CAN_EFF_FLAG | ((fifo->RIR >> 3) & 0x1FFFFFFF);
+		if (mb->rir &  CAN_RI0R_IDE) {
+			rx_frame->can_id = CAN_EFF_FLAG | ((mb->rir >> 3) & 0x1FFFFFFF);
 		} else {
-			rx_frame->can_id = (fifo->RIR >> 21) & 0x7FF;
+			rx_frame->can_id = (mb->rir >> 21) & 0x7FF;
 		}
 
-		if (fifo->RIR & CAN_RI0R_RTR)  {
+		if (mb->rir & CAN_RI0R_RTR)  {
 			rx_frame->can_id |= CAN_RTR_FLAG;
 		}
 
-		rx_frame->can_dlc = fifo->RDTR & CAN_RDT0R_DLC;
+		rx_frame->can_dlc = mb->rdtr & CAN_RDT0R_DLC;
 		rx_frame->channel = can_channel_get_nr(channel);
 		rx_frame->flags = 0;
 
-		rx_frame->classic_can->data[0] = (fifo->RDLR >>  0) & 0xFF;
-		rx_frame->classic_can->data[1] = (fifo->RDLR >>  8) & 0xFF;
-		rx_frame->classic_can->data[2] = (fifo->RDLR >> 16) & 0xFF;
-		rx_frame->classic_can->data[3] = (fifo->RDLR >> 24) & 0xFF;
-		rx_frame->classic_can->data[4] = (fifo->RDHR >>  0) & 0xFF;
-		rx_frame->classic_can->data[5] = (fifo->RDHR >>  8) & 0xFF;
-		rx_frame->classic_can->data[6] = (fifo->RDHR >> 16) & 0xFF;
-		rx_frame->classic_can->data[7] = (fifo->RDHR >> 24) & 0xFF;
+		rx_frame->classic_can->data[0] = (mb->rdlr >>  0) & 0xFF;
+		rx_frame->classic_can->data[1] = (mb->rdlr >>  8) & 0xFF;
+		rx_frame->classic_can->data[2] = (mb->rdlr >> 16) & 0xFF;
+		rx_frame->classic_can->data[3] = (mb->rdlr >> 24) & 0xFF;
+		rx_frame->classic_can->data[4] = (mb->rdhr >>  0) & 0xFF;
+		rx_frame->classic_can->data[5] = (mb->rdhr >>  8) & 0xFF;
+		rx_frame->classic_can->data[6] = (mb->rdhr >> 16) & 0xFF;
+		rx_frame->classic_can->data[7] = (mb->rdhr >> 24) & 0xFF;
 
-		can->RF0R |= CAN_RF0R_RFOM0;         // release FIFO
+		__DMB();
+		ring->tail = tail + 1;          // release ring entry
 
 		return true;
 	} else {
@@ -239,27 +440,31 @@ bool can_receive(can_data_t *channel, struct gs_host_frame *rx_frame)
 	}
 }
 
-static CAN_TxMailBox_TypeDef *can_find_free_mailbox(can_data_t *channel)
+// A mailbox is free once it is empty and its completion has been
+// consumed by can_drv_tx_status().
+static CAN_TxMailBox_TypeDef *can_find_free_mailbox(can_data_t *channel, unsigned int *slot)
 {
 	CAN_TypeDef *can = channel->instance;
 	uint32_t tsr = can->TSR;
 
-	if (tsr & CAN_TSR_TME0) {
-		return &can->sTxMailBox[0];
-	} else if (tsr & CAN_TSR_TME1) {
-		return &can->sTxMailBox[1];
-	} else if (tsr & CAN_TSR_TME2) {
-		return &can->sTxMailBox[2];
-	} else {
-		return 0;
+	for (unsigned int i = 0; i < ARRAY_SIZE(channel->tx_mailbox); i++) {
+		if (tsr & CAN_TSR_TME0 << i && channel->tx_mailbox[i].status == CAN_DRV_TX_IDLE) {
+			*slot = i;
+			return &can->sTxMailBox[i];
+		}
 	}
+
+	return 0;
 }
 
-bool can_send(can_data_t *channel, struct gs_host_frame *frame)
+bool can_send(can_data_t *channel, struct gs_host_frame *frame, unsigned int *slot)
 {
-	CAN_TxMailBox_TypeDef *mb = can_find_free_mailbox(channel);
+	CAN_TxMailBox_TypeDef *mb = can_find_free_mailbox(channel, slot);
 
 	if (mb != 0) {
+		channel->tx_mailbox[*slot].status = CAN_DRV_TX_PENDING;
+		channel->tx_cancel &= ~BIT(*slot);
+
 		/* first, clear transmission request */
 		mb->TIR &= CAN_TI0R_TXRQ;
 
@@ -388,3 +593,26 @@ void can_drv_handle_bus_off_recovery(struct can_channel *channel)
 	can_drv_disable(channel);
 	can_drv_enable(channel);
 }
+
+void can_drv_abort_tx(struct can_channel *channel)
+{
+	CAN_TypeDef *can = channel->instance;
+
+	channel->tx_cancel = BIT(0) | BIT(1) | BIT(2);
+	can->TSR = CAN_TSR_ABRQ0 | CAN_TSR_ABRQ1 | CAN_TSR_ABRQ2;
+}
+
+enum can_drv_tx_status can_drv_tx_status(struct can_channel *channel, unsigned int slot, uint32_t *timestamp_us)
+{
+	struct bxcan_tx_mailbox *mb = &channel->tx_mailbox[slot];
+	const enum can_drv_tx_status status = mb->status;
+
+	if (status == CAN_DRV_TX_IDLE || status == CAN_DRV_TX_PENDING)
+		return status;
+
+	__DMB();
+	*timestamp_us = mb->timestamp_us;
+	mb->status = CAN_DRV_TX_IDLE;
+
+	return status;
+}
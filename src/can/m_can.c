@@ -27,6 +27,7 @@
 #include "board.h"
 #include "can_common.h"
 #include "can_drv.h"
+#include "host_frame.h"
 #include "timer.h"
 
 #define M_CAN_PSR_ACT_SYNC		  0
@@ -36,6 +37,39 @@
 
 #define M_CAN_SYNC_BUS_TIMEOUT_MS 100
 
+/*
+ * Layout of the RX FIFO, TX FIFO and TX event FIFO elements in the
+ * message RAM, the RX and TX buffer elements hold up to 64 bytes of
+ * data behind their two header words.
+ */
+#define M_CAN_ELEMENT_SIZE		  (18 * sizeof(uint32_t))
+#define M_CAN_TX_EVENT_SIZE		  (2 * sizeof(uint32_t))
+
+/* first word */
+#define M_CAN_ELEMENT_ESI		  BIT(31)
+#define M_CAN_ELEMENT_XTD		  BIT(30)
+#define M_CAN_ELEMENT_RTR		  BIT(29)
+#define M_CAN_ELEMENT_STDID		  (CAN_SFF_MASK << 18)
+
+/* second word */
+#define M_CAN_ELEMENT_MM		  (0xffUL << 24)
+#define M_CAN_ELEMENT_EFC		  BIT(23)
+#define M_CAN_ELEMENT_FDF		  BIT(21)
+#define M_CAN_ELEMENT_BRS		  BIT(20)
+#define M_CAN_ELEMENT_DLC		  (0xfUL << 16)
+#define M_CAN_ELEMENT_TS		  0xffffUL
+
+static inline volatile uint32_t *m_can_element(uint32_t start, uint32_t index)
+{
+	return (volatile uint32_t *)(start + index * M_CAN_ELEMENT_SIZE);
+}
+
+// The FIFOs are only accessed between HAL_FDCAN_Start() and _Stop().
+static inline bool m_can_is_started(const struct can_channel *channel)
+{
+	return channel->channel.State == HAL_FDCAN_STATE_BUSY;
+}
+
 const struct gs_device_bt_const CAN_btconst = {
 	.feature =
 		GS_CAN_FEATURE_LISTEN_ONLY |
@@ -44,7 +78,8 @@ const struct gs_device_bt_const CAN_btconst = {
 		GS_CAN_FEATURE_IDENTIFY |
 		GS_CAN_FEATURE_PAD_PKTS_TO_MAX_PKT_SIZE |
 		(IS_ENABLED(CONFIG_CANFD) ?
-		 GS_CAN_FEATURE_FD | GS_CAN_FEATURE_BT_CONST_EXT : 0) |
+		 GS_CAN_FEATURE_FD | GS_CAN_FEATURE_BT_CONST_EXT |
+		 GS_CAN_FEATURE_FD_DLC_TRIM : 0) |
 		(IS_ENABLED(CONFIG_TERMINATION) ?
 		 GS_CAN_FEATURE_TERMINATION : 0) |
 		GS_CAN_FEATURE_BERR_REPORTING |
@@ -52,6 +87,7 @@ const struct gs_device_bt_const CAN_btconst = {
 		(IS_ENABLED(CONFIG_CANFD) ?
 		 GS_CAN_FEATURE_TDC : 0) |
 		GS_CAN_FEATURE_BUS_OFF_RECOVERY |
+		GS_CAN_FEATURE_FIRMWARE_COMMON |
 		0,
 	.fclk_can = CAN_CLOCK_SPEED,
 	.btc = {
@@ -74,7 +110,8 @@ const struct gs_device_bt_const_extended CAN_btconst_ext = {
 		GS_CAN_FEATURE_IDENTIFY |
 		GS_CAN_FEATURE_PAD_PKTS_TO_MAX_PKT_SIZE |
 		(IS_ENABLED(CONFIG_CANFD) ?
-		 GS_CAN_FEATURE_FD | GS_CAN_FEATURE_BT_CONST_EXT : 0) |
+		 GS_CAN_FEATURE_FD | GS_CAN_FEATURE_BT_CONST_EXT |
+		 GS_CAN_FEATURE_FD_DLC_TRIM : 0) |
 		(IS_ENABLED(CONFIG_TERMINATION) ?
 		 GS_CAN_FEATURE_TERMINATION : 0) |
 		GS_CAN_FEATURE_BERR_REPORTING |
@@ -82,6 +119,7 @@ const struct gs_device_bt_const_extended CAN_btconst_ext = {
 		(IS_ENABLED(CONFIG_CANFD) ?
 		 GS_CAN_FEATURE_TDC : 0) |
 		GS_CAN_FEATURE_BUS_OFF_RECOVERY |
+		GS_CAN_FEATURE_FIRMWARE_COMMON |
 		0,
 	.fclk_can = CAN_CLOCK_SPEED,
 	.btc = {
@@ -114,8 +152,38 @@ const struct gs_device_tdc_const CAN_tdc_const = {
 	.mode = GS_CAN_TDC_MODE_OFF | GS_CAN_TDC_MODE_AUTO,
 };
 
+/*
+ * The FDCAN time stamps frames with the 16 bit counter of TIM3, run
+ * at 1 MHz like TIM2 of timer_get(). It is only used for the TX
+ * events, which are drained well within its 65 ms period.
+ */
+static void m_can_timestamp_init(void)
+{
+	if (TIM3->CR1 & TIM_CR1_CEN)
+		return;
+
+	__HAL_RCC_TIM3_CLK_ENABLE();
+
+	TIM3->CR1 = 0;
+	TIM3->PSC = (TIM2_CLOCK_SPEED / 1000000) - 1;   // run @1MHz = 1us
+	TIM3->ARR = 0xFFFF;
+	TIM3->EGR = TIM_EGR_UG;
+	TIM3->CR1 |= TIM_CR1_CEN;
+}
+
+// Extend a 16 bit FDCAN time stamp to the 32 bit time of timer_get().
+static uint32_t m_can_timestamp_to_us(uint16_t timestamp)
+{
+	const uint16_t now16 = TIM3->CNT;
+	const uint32_t now = timer_get();
+
+	return now - (uint16_t)(now16 - timestamp);
+}
+
 void can_init(struct can_channel *channel, const struct board_channel_config *config)
 {
+	m_can_timestamp_init();
+
 	channel->channel.Instance = config->interface;
 	channel->channel.Init.ClockDivider = FDCAN_CLOCK_DIV1;
 	channel->channel.Init.FrameFormat = FDCAN_FRAME_FD_BRS;
@@ -155,6 +223,22 @@ static void m_can_set_bittiming(struct can_channel *channel)
 	channel->channel.Init.DataPrescaler = dbt->brp;
 }
 
+// Forget the frames of a restarted controller, along with their
+// stale TX events.
+static void m_can_tx_reset(struct can_channel *channel)
+{
+	FDCAN_GlobalTypeDef *can = channel->channel.Instance;
+	uint32_t txefs;
+
+	while ((txefs = can->TXEFS) & FDCAN_TXEFS_EFFL)
+		can->TXEFA = FIELD_GET(FDCAN_TXEFS_EFGI, txefs);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(channel->tx_buffer); i++)
+		channel->tx_buffer[i].status = CAN_DRV_TX_IDLE;
+
+	channel->tx_cancel = 0;
+}
+
 void can_drv_enable(struct can_channel *channel)
 {
 	m_can_set_bittiming(channel);
@@ -187,6 +271,8 @@ void can_drv_enable(struct can_channel *channel)
 
 	HAL_FDCAN_Init(&channel->channel);
 
+	HAL_FDCAN_EnableTimestampCounter(&channel->channel, FDCAN_TIMESTAMP_EXTERNAL);
+
 	HAL_FDCAN_EnableISOMode(&channel->channel);
 
 	/* Configure reception filter to Rx FIFO 0 on both FDCAN instances */
@@ -217,6 +303,8 @@ void can_drv_enable(struct can_channel *channel)
 	}
 
 	HAL_FDCAN_Start(&channel->channel);
+
+	m_can_tx_reset(channel);
 }
 
 void can_drv_disable(struct can_channel *channel)
@@ -226,93 +314,126 @@ void can_drv_disable(struct can_channel *channel)
 
 bool can_receive(struct can_channel *channel, struct gs_host_frame *rx_frame)
 {
-	FDCAN_RxHeaderTypeDef RxHeader;
-	uint32_t timestamp_us = timer_get();
+	FDCAN_GlobalTypeDef *can = channel->channel.Instance;
+	const uint32_t rxf0s = can->RXF0S;
+	const uint32_t timestamp_us = timer_get();
 
-	if (HAL_FDCAN_GetRxMessage(&channel->channel, FDCAN_RX_FIFO0, &RxHeader, rx_frame->canfd->data) != HAL_OK) {
+	if (!m_can_is_started(channel) || !(rxf0s & FDCAN_RXF0S_F0FL)) {
 		return false;
 	}
 
+	// The RX FIFO is in blocking mode, the get index is the oldest frame.
+	const uint32_t get = FIELD_GET(FDCAN_RXF0S_F0GI, rxf0s);
+	const volatile uint32_t *element = m_can_element(channel->channel.msgRam.RxFIFO0SA, get);
+	const uint32_t r0 = element[0];
+	const uint32_t r1 = element[1];
+
 	rx_frame->channel = can_channel_get_nr(channel);
 	rx_frame->flags = 0;
-	rx_frame->can_id = RxHeader.Identifier;
 
-	if (RxHeader.IdType == FDCAN_EXTENDED_ID) {
-		rx_frame->can_id |= CAN_EFF_FLAG;
+	if (r0 & M_CAN_ELEMENT_XTD) {
+		rx_frame->can_id = (r0 & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	} else {
+		rx_frame->can_id = FIELD_GET(M_CAN_ELEMENT_STDID, r0);
 	}
 
-	if (RxHeader.RxFrameType == FDCAN_REMOTE_FRAME) {
+	if (r0 & M_CAN_ELEMENT_RTR) {
 		rx_frame->can_id |= CAN_RTR_FLAG;
 	}
 
-	rx_frame->can_dlc = RxHeader.DataLength & 0x0f;
+	rx_frame->can_dlc = FIELD_GET(M_CAN_ELEMENT_DLC, r1);
 
-	if (RxHeader.FDFormat == FDCAN_FD_CAN) {
+	if (r1 & M_CAN_ELEMENT_FDF) {
 		rx_frame->canfd_ts->timestamp_us = timestamp_us;
 
 		/* this is a CAN-FD frame */
 		rx_frame->flags = GS_CAN_FLAG_FD;
-		if (RxHeader.BitRateSwitch == FDCAN_BRS_ON) {
+		if (r1 & M_CAN_ELEMENT_BRS) {
 			rx_frame->flags |= GS_CAN_FLAG_BRS;
 		}
 
-		if (RxHeader.ErrorStateIndicator == FDCAN_ESI_PASSIVE) {
+		if (r0 & M_CAN_ELEMENT_ESI) {
 			rx_frame->flags |= GS_CAN_FLAG_ESI;
 		}
 	} else {
 		rx_frame->classic_can_ts->timestamp_us = timestamp_us;
 	}
 
+	uint32_t *data = (uint32_t *)rx_frame->canfd->data;
+	const size_t words = (gs_host_frame_data_len(rx_frame) + 3) / sizeof(uint32_t);
+
+	for (size_t i = 0; i < words; i++)
+		data[i] = element[2 + i];
+
+	// release the FIFO element
+	can->RXF0A = get;
+
 	return true;
 }
 
 bool can_is_rx_pending(struct can_channel *channel)
 {
-	return (HAL_FDCAN_GetRxFifoFillLevel(&channel->channel, FDCAN_RX_FIFO0) >= 1);
+	return channel->channel.Instance->RXF0S & FDCAN_RXF0S_F0FL;
 }
 
-bool can_send(struct can_channel *channel, struct gs_host_frame *frame)
+bool can_send(struct can_channel *channel, struct gs_host_frame *frame, unsigned int *slot)
 {
-	FDCAN_TxHeaderTypeDef TxHeader = {
-		.DataLength = frame->can_dlc,
-		.TxEventFifoControl = FDCAN_NO_TX_EVENTS,
-	};
+	FDCAN_GlobalTypeDef *can = channel->channel.Instance;
+	const uint32_t txfqs = can->TXFQS;
 
-	if (frame->can_id & CAN_RTR_FLAG) {
-		TxHeader.TxFrameType = FDCAN_REMOTE_FRAME;
-	} else {
-		TxHeader.TxFrameType = FDCAN_DATA_FRAME;
+	if (!m_can_is_started(channel) || txfqs & FDCAN_TXFQS_TFQF) {
+		return false;
 	}
 
+	// The TX buffer the FIFO puts the frame in, its index is the
+	// message marker of the TX event.
+	const uint32_t put = FIELD_GET(FDCAN_TXFQS_TFQPI, txfqs);
+
+	// Wait until the last completion of the buffer has been consumed.
+	if (put >= ARRAY_SIZE(channel->tx_buffer) ||
+		channel->tx_buffer[put].status != CAN_DRV_TX_IDLE)
+		return false;
+
+	uint32_t t0;
+	uint32_t t1 = FIELD_PREP(M_CAN_ELEMENT_MM, put) | M_CAN_ELEMENT_EFC |
+				  FIELD_PREP(M_CAN_ELEMENT_DLC, frame->can_dlc);
+
 	if (frame->can_id & CAN_EFF_FLAG) {
-		TxHeader.IdType = FDCAN_EXTENDED_ID;
-		TxHeader.Identifier = frame->can_id & 0x1FFFFFFF;
+		t0 = M_CAN_ELEMENT_XTD | (frame->can_id & CAN_EFF_MASK);
 	} else {
-		TxHeader.IdType = FDCAN_STANDARD_ID;
-		TxHeader.Identifier = frame->can_id & 0x7FF;
+		t0 = FIELD_PREP(M_CAN_ELEMENT_STDID, frame->can_id & CAN_SFF_MASK);
+	}
+
+	if (frame->can_id & CAN_RTR_FLAG) {
+		t0 |= M_CAN_ELEMENT_RTR;
 	}
 
 	if (frame->flags & GS_CAN_FLAG_FD) {
-		TxHeader.FDFormat = FDCAN_FD_CAN;
+		t1 |= M_CAN_ELEMENT_FDF;
 		if (frame->flags & GS_CAN_FLAG_BRS) {
-			TxHeader.BitRateSwitch = FDCAN_BRS_ON;
-		} else {
-			TxHeader.BitRateSwitch = FDCAN_BRS_OFF;
+			t1 |= M_CAN_ELEMENT_BRS;
 		}
 
 		if (frame->flags & GS_CAN_FLAG_ESI) {
-			TxHeader.ErrorStateIndicator = FDCAN_ESI_PASSIVE;
-		} else {
-			TxHeader.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
+			t0 |= M_CAN_ELEMENT_ESI;
 		}
-	} else {
-		TxHeader.FDFormat = FDCAN_CLASSIC_CAN;
-		TxHeader.BitRateSwitch = FDCAN_BRS_OFF;
 	}
 
-	if (HAL_FDCAN_AddMessageToTxFifoQ(&channel->channel, &TxHeader, frame->canfd->data) != HAL_OK) {
-		return false;
-	}
+	volatile uint32_t *element = m_can_element(channel->channel.msgRam.TxFIFOQSA, put);
+	const uint32_t *data = (const uint32_t *)frame->canfd->data;
+	const size_t words = (gs_host_frame_data_len(frame) + 3) / sizeof(uint32_t);
+
+	element[0] = t0;
+	element[1] = t1;
+	for (size_t i = 0; i < words; i++)
+		element[2 + i] = data[i];
+
+	// request transmission
+	can->TXBAR = BIT(put);
+
+	channel->tx_buffer[put].status = CAN_DRV_TX_PENDING;
+	channel->tx_cancel &= ~BIT(put);
+	*slot = put;
 
 	return true;
 }
@@ -434,5 +555,68 @@ void can_drv_handle_bus_off_recovery(struct can_channel *channel)
 	HAL_FDCAN_Stop(&channel->channel);
 	HAL_FDCAN_Start(&channel->channel);
 
+	m_can_tx_reset(channel);
 	m_can_synchronize_bus(channel);
 }
+
+void can_drv_abort_tx(struct can_channel *channel)
+{
+	channel->tx_cancel = FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2;
+	HAL_FDCAN_AbortTxRequest(&channel->channel, FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2);
+}
+
+// Complete the TX buffers of the TX events, the message marker is the
+// index of the buffer. The time stamp is the start of the frame.
+static void m_can_tx_event_drain(struct can_channel *channel)
+{
+	FDCAN_GlobalTypeDef *can = channel->channel.Instance;
+	uint32_t txefs;
+
+	while ((txefs = can->TXEFS) & FDCAN_TXEFS_EFFL) {
+		const uint32_t get = FIELD_GET(FDCAN_TXEFS_EFGI, txefs);
+		const volatile uint32_t *event =
+			(const volatile uint32_t *)(channel->channel.msgRam.TxEventFIFOSA + get * M_CAN_TX_EVENT_SIZE);
+		const uint32_t e1 = event[1];
+		const uint32_t marker = FIELD_GET(M_CAN_ELEMENT_MM, e1);
+
+		can->TXEFA = get;
+
+		if (marker >= ARRAY_SIZE(channel->tx_buffer))
+			continue;
+
+		struct m_can_tx_buffer *buf = &channel->tx_buffer[marker];
+
+		if (buf->status != CAN_DRV_TX_PENDING)
+			continue;
+
+		buf->timestamp_us = m_can_timestamp_to_us(FIELD_GET(M_CAN_ELEMENT_TS, e1));
+		buf->status = CAN_DRV_TX_OK;
+	}
+}
+
+enum can_drv_tx_status can_drv_tx_status(struct can_channel *channel, unsigned int slot, uint32_t *timestamp_us)
+{
+	const FDCAN_GlobalTypeDef *can = channel->channel.Instance;
+	struct m_can_tx_buffer *buf = &channel->tx_buffer[slot];
+	const uint32_t mask = BIT(slot);
+
+	m_can_tx_event_drain(channel);
+
+	// Only sent frames have a TX event. The cancellation of a
+	// buffer finishes, if it was aborted or failed in one-shot mode.
+	if (buf->status == CAN_DRV_TX_PENDING &&
+		!(can->TXBRP & mask) && can->TXBCF & mask) {
+		buf->timestamp_us = timer_get();
+		buf->status = channel->tx_cancel & mask ? CAN_DRV_TX_ABORTED : CAN_DRV_TX_FAILED;
+	}
+
+	const enum can_drv_tx_status status = buf->status;
+
+	if (status == CAN_DRV_TX_IDLE || status == CAN_DRV_TX_PENDING)
+		return status;
+
+	*timestamp_us = buf->timestamp_us;
+	buf->status = CAN_DRV_TX_IDLE;
+
+	return status;
+}
@@ -208,26 +208,51 @@ bool can_is_enabled(const struct can_channel *channel)
 
 void can_enable(struct can_channel *channel, const uint32_t feature)
 {
+	// Drop the frames queued while stopped. The main loop returns
+	// the frames of the TX slots, too, once it sees the flush, as
+	// can_drv_enable() resets the TX mailboxes.
+	frame_ring_flush(&channel->ring_from_host);
+
 	led_set_mode(&channel->leds, LED_MODE_NORMAL);
 
 	channel->feature = feature;
 	channel->state = GS_CAN_STATE_ERROR_ACTIVE;
+	channel->tx_echo_count = 0;
+	channel->rx_overflow = false;
+	channel->rx_overflow_reported = false;
+	channel->rx_compact_ts.valid = false;
 	can_calc_tdco(channel);
 
 	board_phy_power_set(channel, true);
 	can_drv_enable(channel);
 }
 
+// Abort the frames of a started channel not sent yet, without leaving
+// the bus. Only flush the ring here, the main loop aborts the TX
+// mailboxes and echoes the frames once it sees the flush.
+void can_abort_tx(struct can_channel *channel)
+{
+	channel->tx_abort_flush_seq = frame_ring_flush_seq(&channel->ring_from_host) + 1;
+	__DMB();
+	frame_ring_flush(&channel->ring_from_host);
+}
+
 void can_disable(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
 {
 	can_drv_disable(channel);
 	board_phy_power_set(channel, false);
 
-	usbd_gs_can_purge_from_host_list_by_channel(hcan, channel);
+	// the main loop returns the queued frames and the TX slots
+	frame_ring_flush(&channel->ring_from_host);
 	usbd_gs_can_purge_to_host_list_by_channel(hcan, channel);
 
 	can_clear_tdc(channel);
 	channel->bus_off_restart = CAN_CHANNEL_BUS_OFF_RESTART_DISABLED;
+	channel->tx_echo_interval = 0;
+	channel->pool_quota_min = gs_host_frame_pool_quota_min(hcan);
+	channel->pool_quota_max = GS_HOST_FRAME_POOL_QUOTA_MAX;
+	channel->rx_format = GS_DEVICE_RX_FORMAT_DEFAULT;
+	channel->tx_coalesce_count = 0;
 	channel->state = GS_CAN_STATE_STOPPED;
 	channel->flags = 0;
 	channel->feature = 0;
@@ -235,72 +260,364 @@ void can_disable(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
 	led_set_mode(&channel->leds, LED_MODE_OFF);
 }
 
-void CAN_SendFrame(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+static bool can_tx_echo_suppressed(struct can_channel *channel,
+								   const struct gs_host_frame *frame)
 {
-	struct gs_host_frame_object *frame_object;
+	if (!(channel->feature & GS_CAN_FEATURE_TX_ECHO_SUPPRESS))
+		return false;
 
-	bool was_irq_enabled = disable_irq();
-	frame_object = list_first_entry_or_null(&channel->list_from_host,
-											struct gs_host_frame_object,
-											list);
-	if (!frame_object) {
-		restore_irq(was_irq_enabled);
-		return;
+	// The host has to learn about frames that were not sent.
+	if (frame->flags & GS_CAN_FLAG_TX_STATUS)
+		return false;
+
+	if (!channel->tx_echo_interval ||
+		++channel->tx_echo_count < channel->tx_echo_interval)
+		return true;
+
+	channel->tx_echo_count = 0;
+
+	return false;
+}
+
+// Like frame_ring_peek(), but skip the entries cleared by
+// can_tx_coalesce().
+static bool can_tx_ring_peek(struct frame_ring *ring, frame_ring_idx_t *idx)
+{
+	while (frame_ring_peek(ring, idx)) {
+		if (*idx != FRAME_RING_IDX_NONE)
+			return true;
+
+		frame_ring_pop(ring);
+	}
+
+	return false;
+}
+
+// Move the frames received from the host to the channel's TX priority
+// heap, as long as it has room. With TX coalescing only up to
+// tx_coalesce_pos: can_tx_coalesce() hasn't looked at the later
+// frames yet and would skip them, once they have left the ring.
+static void can_tx_prio_fill(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	struct frame_ring *ring = &channel->ring_from_host;
+	struct frame_heap *heap = &channel->heap_from_host;
+	const bool coalesce = channel->feature & GS_CAN_FEATURE_TX_COALESCE;
+	frame_ring_idx_t idx;
+
+	while (!frame_heap_is_full(heap) &&
+		   !(coalesce && frame_ring_tail(ring) == channel->tx_coalesce_pos) &&
+		   can_tx_ring_peek(ring, &idx)) {
+		const struct gs_host_frame_object *frame_object =
+			gs_host_frame_object_from_idx(hcan, idx);
+
+		frame_heap_push(heap, can_tx_prio_key(&frame_object->frame), idx);
+		frame_ring_pop(ring);
 	}
+}
+
+// The deadline of a frame from the host is kept in its timestamp, see
+// GS_CAN_FEATURE_TX_DEADLINE.
+static uint32_t *can_tx_deadline(struct gs_host_frame *frame)
+{
+	if (gs_host_frame_is_fd(frame))
+		return &frame->canfd_ts->timestamp_us;
+
+	return &frame->classic_can_ts->timestamp_us;
+}
+
+static bool can_tx_expired(const can_data_t *channel, struct gs_host_frame *frame)
+{
+	if (!(channel->feature & GS_CAN_FEATURE_TX_DEADLINE))
+		return false;
+
+	const uint32_t deadline = *can_tx_deadline(frame);
 
-	list_del(&frame_object->list);
-	restore_irq(was_irq_enabled);
+	return deadline && (int32_t)(timer_get() - deadline) >= 0;
+}
 
+// Echo a frame sent to the CAN bus, or discarded, back to the host,
+// or return it to the pool.
+static void can_tx_done(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel,
+						struct gs_host_frame_object *frame_object, uint32_t timestamp_us)
+{
 	struct gs_host_frame *frame = &frame_object->frame;
 
-	if (!can_send(channel, frame)) {
-		list_add_locked(&frame_object->list, &channel->list_from_host);
+	if (can_tx_echo_suppressed(channel, frame)) {
+		gs_host_frame_object_put_locked(hcan, frame_object);
 		return;
 	}
 
-	// Echo sent frame back to host
 	frame->reserved = 0x0;
 	if (IS_ENABLED(CONFIG_CANFD) && frame->flags & GS_CAN_FLAG_FD)
-		frame->canfd_ts->timestamp_us = timer_get();
+		frame->canfd_ts->timestamp_us = timestamp_us;
 	else
-		frame->classic_can_ts->timestamp_us = timer_get();
+		frame->classic_can_ts->timestamp_us = timestamp_us;
 
-	list_add_tail_locked(&frame_object->list, &hcan->list_to_host);
+	list_add_tail_locked(&frame_object->list, &channel->list_to_host);
+}
 
-	led_indicate_trx(&channel->leds, LED_TX);
+static struct can_tx_coalesce *can_tx_coalesce_find(can_data_t *channel, uint32_t can_id)
+{
+	for (unsigned int i = 0; i < channel->tx_coalesce_count; i++) {
+		if (channel->tx_coalesce[i].can_id == can_id)
+			return &channel->tx_coalesce[i];
+	}
+
+	return NULL;
 }
 
-void CAN_ReceiveFrame(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+static void can_tx_coalesce_reset(can_data_t *channel)
 {
-	struct gs_host_frame_object *frame_object;
+	for (unsigned int i = 0; i < ARRAY_SIZE(channel->tx_coalesce); i++)
+		channel->tx_coalesce[i].idx = FRAME_RING_IDX_NONE;
+}
 
-	if (!can_is_rx_pending(channel)) {
+// The frame object idx has been sent, the next frame with its ID
+// will be queued again.
+static void can_tx_coalesce_sent(can_data_t *channel, frame_ring_idx_t idx)
+{
+	if (!(channel->feature & GS_CAN_FEATURE_TX_COALESCE))
 		return;
+
+	for (unsigned int i = 0; i < channel->tx_coalesce_count; i++) {
+		if (channel->tx_coalesce[i].idx == idx)
+			channel->tx_coalesce[i].idx = FRAME_RING_IDX_NONE;
 	}
+}
 
-	frame_object = gs_host_frame_object_get_locked(hcan);
-	if (!frame_object) {
-		return;
+// Put the frame object idx in place of the queued frame object old,
+// in the ring before the position end or in the TX priority heap.
+static bool can_tx_coalesce_replace(can_data_t *channel, unsigned int end,
+									frame_ring_idx_t old, frame_ring_idx_t idx)
+{
+	struct frame_ring *ring = &channel->ring_from_host;
+	frame_ring_idx_t iter;
+
+	if (frame_heap_replace(&channel->heap_from_host, old, idx))
+		return true;
+
+	for (unsigned int pos = frame_ring_tail(ring); pos != end; pos++) {
+		if (frame_ring_peek_at(ring, pos, &iter) && iter == old) {
+			frame_ring_set_at(ring, pos, idx);
+			return true;
+		}
 	}
 
-	struct gs_host_frame *frame = &frame_object->frame;
+	return false;
+}
+
+/*
+ * Look at the frames received from the host since the last call. If
+ * a frame has an ID of the channel's coalesce table and a frame with
+ * that ID is still queued, the new frame takes the queued frame's
+ * place in the queue and its entry in the ring is cleared. The
+ * replaced frame is echoed right away with GS_CAN_FLAG_TX_ABORTED, so
+ * the host's echo bookkeeping stays intact.
+ */
+static void can_tx_coalesce(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	struct frame_ring *ring = &channel->ring_from_host;
+	frame_ring_idx_t idx;
+
+	if ((int)(channel->tx_coalesce_pos - frame_ring_tail(ring)) < 0)
+		channel->tx_coalesce_pos = frame_ring_tail(ring);
+
+	while (frame_ring_peek_at(ring, channel->tx_coalesce_pos, &idx)) {
+		const unsigned int pos = channel->tx_coalesce_pos++;
+
+		if (idx == FRAME_RING_IDX_NONE)
+			continue;
+
+		struct gs_host_frame_object *frame_object = gs_host_frame_object_from_idx(hcan, idx);
+		struct gs_host_frame *frame = &frame_object->frame;
+		struct can_tx_coalesce *entry = can_tx_coalesce_find(channel, frame->can_id);
+
+		if (!entry)
+			continue;
+
+		if (entry->idx == FRAME_RING_IDX_NONE) {
+			entry->idx = idx;
+			continue;
+		}
+
+		const frame_ring_idx_t queued = entry->idx;
 
-	if (!can_receive(channel, frame)) {
-		list_add_tail_locked(&frame_object->list, &hcan->list_frame_pool);
+		entry->idx = idx;
+		if (!can_tx_coalesce_replace(channel, pos, queued, idx))
+			continue;
+
+		frame_ring_clear_at(ring, pos);
+
+		struct gs_host_frame_object *replaced = gs_host_frame_object_from_idx(hcan, queued);
+
+		replaced->frame.flags |= GS_CAN_FLAG_TX_ABORTED;
+		can_tx_done(hcan, channel, replaced, timer_get());
+	}
+}
+
+static void can_tx_flushed(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel,
+						   struct gs_host_frame_object *frame_object, bool abort)
+{
+	if (!abort) {
+		gs_host_frame_object_put_locked(hcan, frame_object);
 		return;
 	}
 
-	frame->echo_id = GS_HOST_FRAME_ECHO_ID_RX; // not an echo frame
-	frame->reserved = 0;
+	frame_object->frame.flags |= GS_CAN_FLAG_TX_ABORTED;
+	can_tx_done(hcan, channel, frame_object, timer_get());
+}
+
+// Echo the frames the CAN controller has finished with, timestamped
+// at their completion, in the order they completed.
+static void can_tx_complete(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	enum can_drv_tx_status status[CAN_TX_SLOTS];
+	uint32_t timestamp_us[CAN_TX_SLOTS];
 
-	list_add_tail_locked(&frame_object->list, &hcan->list_to_host);
+	for (unsigned int slot = 0; slot < ARRAY_SIZE(channel->tx_slot); slot++) {
+		status[slot] = CAN_DRV_TX_IDLE;
+		if (channel->tx_slot[slot] != FRAME_RING_IDX_NONE)
+			status[slot] = can_drv_tx_status(channel, slot, &timestamp_us[slot]);
+	}
 
-	led_indicate_trx(&channel->leds, LED_RX);
+	for (;;) {
+		struct gs_host_frame_object *frame_object;
+		int next = -1;
+
+		for (unsigned int slot = 0; slot < ARRAY_SIZE(channel->tx_slot); slot++) {
+			if (status[slot] == CAN_DRV_TX_IDLE || status[slot] == CAN_DRV_TX_PENDING)
+				continue;
+
+			if (next < 0 || (int32_t)(timestamp_us[slot] - timestamp_us[next]) < 0)
+				next = slot;
+		}
+
+		if (next < 0)
+			return;
+
+		frame_object = gs_host_frame_object_from_idx(hcan, channel->tx_slot[next]);
+		if (status[next] == CAN_DRV_TX_FAILED) {
+			frame_object->frame.flags |= GS_CAN_FLAG_TX_FAILED;
+			channel->tx_failed++;
+		} else if (status[next] == CAN_DRV_TX_ABORTED) {
+			frame_object->frame.flags |= GS_CAN_FLAG_TX_ABORTED;
+		}
+
+		status[next] = CAN_DRV_TX_IDLE;
+		channel->tx_slot[next] = FRAME_RING_IDX_NONE;
+		can_tx_done(hcan, channel, frame_object, timestamp_us[next]);
+	}
 }
 
-void can_get_device_state(const struct can_channel *channel, struct gs_device_state *state)
+// Return the frames still in the CAN controller to the pool, or echo
+// them as failed, after it has been reset.
+static void can_tx_slots_flush(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel, bool echo)
 {
-	can_drv_get_device_state(channel, state);
+	for (unsigned int slot = 0; slot < ARRAY_SIZE(channel->tx_slot); slot++) {
+		const frame_ring_idx_t idx = channel->tx_slot[slot];
+		struct gs_host_frame_object *frame_object;
+
+		if (idx == FRAME_RING_IDX_NONE)
+			continue;
+
+		frame_object = gs_host_frame_object_from_idx(hcan, idx);
+		channel->tx_slot[slot] = FRAME_RING_IDX_NONE;
+
+		if (!echo) {
+			gs_host_frame_object_put_locked(hcan, frame_object);
+			continue;
+		}
+
+		frame_object->frame.flags |= GS_CAN_FLAG_TX_FAILED;
+		channel->tx_failed++;
+		can_tx_done(hcan, channel, frame_object, timer_get());
+	}
+}
+
+// Remove the frame returned by the last peek from the queue.
+static void can_tx_pop(can_data_t *channel, bool prio)
+{
+	if (prio)
+		frame_heap_pop(&channel->heap_from_host);
+	else
+		frame_ring_pop(&channel->ring_from_host);
+}
+
+void CAN_SendFrame(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	struct frame_heap *heap = &channel->heap_from_host;
+	struct gs_host_frame_object *frame_object;
+	const unsigned int flush_seq = frame_ring_flush_seq(&channel->ring_from_host);
+	const bool abort = channel->tx_abort_flush_seq == flush_seq && can_is_enabled(channel);
+	const bool prio = channel->feature & GS_CAN_FEATURE_TX_PRIO;
+	frame_ring_idx_t idx;
+	unsigned int slot;
+
+	// Return the frames of a stopped or restarted channel to the
+	// pool, or echo the aborted ones. The heap and the coalesce
+	// table are only touched here, so they are flushed along with
+	// the ring.
+	if (heap->flush_seq != flush_seq) {
+		if (abort)
+			can_drv_abort_tx(channel);
+		else
+			can_tx_slots_flush(hcan, channel, false);
+
+		while (frame_heap_peek(heap, &idx)) {
+			frame_heap_pop(heap);
+			can_tx_flushed(hcan, channel, gs_host_frame_object_from_idx(hcan, idx), abort);
+		}
+		can_tx_coalesce_reset(channel);
+		heap->flush_seq = flush_seq;
+	}
+
+	while (frame_ring_peek_flushed(&channel->ring_from_host, &idx)) {
+		frame_ring_pop(&channel->ring_from_host);
+		if (idx != FRAME_RING_IDX_NONE)
+			can_tx_flushed(hcan, channel, gs_host_frame_object_from_idx(hcan, idx), abort);
+	}
+
+	// Don't send on a stopped channel, a stopped bxCAN is in init
+	// mode and would hold the frames in its mailboxes.
+	if (!can_is_enabled(channel))
+		return;
+
+	can_tx_complete(hcan, channel);
+
+	if (channel->feature & GS_CAN_FEATURE_TX_COALESCE)
+		can_tx_coalesce(hcan, channel);
+
+	for (;;) {
+		if (prio) {
+			can_tx_prio_fill(hcan, channel);
+			if (!frame_heap_peek(heap, &idx))
+				return;
+		} else if (!can_tx_ring_peek(&channel->ring_from_host, &idx)) {
+			return;
+		}
+
+		frame_object = gs_host_frame_object_from_idx(hcan, idx);
+		if (!can_tx_expired(channel, &frame_object->frame))
+			break;
+
+		// Echo expired frames without sending them.
+		can_tx_pop(channel, prio);
+		can_tx_coalesce_sent(channel, idx);
+		channel->tx_expired++;
+		frame_object->frame.flags |= GS_CAN_FLAG_TX_EXPIRED;
+		can_tx_done(hcan, channel, frame_object, timer_get());
+	}
+
+	// Leave the frame queued, if the TX mailboxes are full.
+	if (!can_send(channel, &frame_object->frame, &slot))
+		return;
+
+	// The frame is echoed by can_tx_complete(), once it is on the bus.
+	can_tx_pop(channel, prio);
+	can_tx_coalesce_sent(channel, idx);
+	channel->tx_slot[slot] = idx;
+
+	led_indicate_trx(&channel->leds, LED_TX);
 }
 
 static void can_prepare_error_frame(const struct can_channel *channel,
@@ -318,6 +635,86 @@ static void can_prepare_error_frame(const struct can_channel *channel,
 	frame->classic_can_ts->timestamp_us = timer_get();
 }
 
+// The frame pool is exhausted, i.e. the host doesn't keep up. Mark the
+// next received frame with GS_CAN_FLAG_OVERFLOW and send a single
+// error frame per overflow from the reserved part of the pool.
+static void can_handle_overflow(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
+{
+	channel->rx_overflow = true;
+
+	if (channel->rx_overflow_reported)
+		return;
+
+	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_reserved_locked(hcan, channel);
+	if (!frame_object)
+		return;
+
+	struct gs_host_frame *frame = &frame_object->frame;
+	can_prepare_error_frame(channel, frame);
+
+	frame->can_id |= CAN_ERR_CRTL;
+	frame->classic_can->data[1] |= CAN_ERR_CRTL_RX_OVERFLOW;
+
+	list_add_tail_locked(&frame_object->list, &channel->list_to_host);
+
+	channel->rx_overflow_reported = true;
+}
+
+void CAN_ReceiveFrame(USBD_GS_CAN_HandleTypeDef *hcan, can_data_t *channel)
+{
+	struct gs_host_frame_object *frame_object;
+	struct gs_host_frame_object rx;
+
+	if (!can_is_rx_pending(channel)) {
+		return;
+	}
+
+	// The frame type, and thus the pool to take the object from, is
+	// only known after reading the frame.
+	if (!can_receive(channel, &rx.frame))
+		return;
+
+	// The driver dropped frames, report them like an exhausted pool.
+	if (channel->rx_overflow)
+		can_handle_overflow(hcan, channel);
+
+	const bool fd = gs_host_frame_is_fd(&rx.frame);
+
+	frame_object = gs_host_frame_object_get_locked(hcan, channel, fd);
+	if (!frame_object) {
+		// Drop the frame, instead of leaving it in the RX FIFO,
+		// where it would block error handling and finally overflow
+		// without notice.
+		channel->rx_dropped++;
+		can_handle_overflow(hcan, channel);
+
+		return;
+	}
+
+	struct gs_host_frame *frame = &frame_object->frame;
+
+	memcpy(frame_object->_buf, rx._buf,
+		   fd ? GS_HOST_FRAME_SIZE : GS_HOST_FRAME_CLASSIC_SIZE);
+
+	frame->echo_id = GS_HOST_FRAME_ECHO_ID_RX; // not an echo frame
+	frame->reserved = 0;
+
+	if (channel->rx_overflow) {
+		frame->flags |= GS_CAN_FLAG_OVERFLOW;
+		channel->rx_overflow = false;
+		channel->rx_overflow_reported = false;
+	}
+
+	list_add_tail_locked(&frame_object->list, &channel->list_to_host);
+
+	led_indicate_trx(&channel->leds, LED_RX);
+}
+
+void can_get_device_state(const struct can_channel *channel, struct gs_device_state *state)
+{
+	can_drv_get_device_state(channel, state);
+}
+
 enum gs_can_state can_err_to_state(const uint16_t err)
 {
 	if (err < CAN_ERROR_WARNING_THRESHOLD)
@@ -384,9 +781,9 @@ void can_lec_error_to_frame(struct gs_host_frame *frame, const uint8_t lec)
 	}
 }
 
-static void can_handle_bus_error(USBD_GS_CAN_HandleTypeDef *hcan, const struct can_channel *channel)
+static void can_handle_bus_error(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
 {
-	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan);
+	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan, channel, false);
 	if (!frame_object)
 		return;
 
@@ -395,9 +792,9 @@ static void can_handle_bus_error(USBD_GS_CAN_HandleTypeDef *hcan, const struct c
 	can_prepare_error_frame(channel, frame);
 	bool handled = can_drv_handle_bus_error(channel, frame);
 	if (handled) {
-		list_add_tail_locked(&frame_object->list, &hcan->list_to_host);
+		list_add_tail_locked(&frame_object->list, &channel->list_to_host);
 	} else {
-		list_add_locked(&frame_object->list, &hcan->list_frame_pool);
+		gs_host_frame_object_put_locked(hcan, frame_object);
 	}
 }
 
@@ -426,9 +823,12 @@ void can_schedule_bus_off_recovery(struct can_channel *channel, const uint32_t d
 
 static void can_handle_state_change(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
 {
-	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan);
-	if (!frame_object)
+	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan, channel, false);
+	if (!frame_object) {
+		channel->err_dropped++;
+		can_handle_overflow(hcan, channel);
 		return;
+	}
 
 	struct gs_host_frame *frame = &frame_object->frame;
 	can_prepare_error_frame(channel, frame);
@@ -445,7 +845,7 @@ static void can_handle_state_change(USBD_GS_CAN_HandleTypeDef *hcan, struct can_
 		can_drv_handle_bus_error(channel, frame);
 	}
 
-	list_add_tail_locked(&frame_object->list, &hcan->list_to_host);
+	list_add_tail_locked(&frame_object->list, &channel->list_to_host);
 }
 
 static bool can_state_change_pending(struct can_channel *channel)
@@ -464,20 +864,26 @@ static bool can_state_change_pending(struct can_channel *channel)
 
 static void can_handle_bus_off_recovery(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
 {
+	// The reset discards the frames still in the CAN controller.
+	can_tx_complete(hcan, channel);
 	can_drv_handle_bus_off_recovery(channel);
+	can_tx_slots_flush(hcan, channel, true);
 
 	channel->bus_off_restart = CAN_CHANNEL_BUS_OFF_RESTART_DISABLED;
 
-	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan);
-	if (!frame_object)
+	struct gs_host_frame_object *frame_object = gs_host_frame_object_get_locked(hcan, channel, false);
+	if (!frame_object) {
+		channel->err_dropped++;
+		can_handle_overflow(hcan, channel);
 		return;
+	}
 
 	struct gs_host_frame *frame = &frame_object->frame;
 	can_prepare_error_frame(channel, frame);
 
 	frame->can_id |= CAN_ERR_RESTARTED;
 
-	list_add_tail_locked(&frame_object->list, &hcan->list_to_host);
+	list_add_tail_locked(&frame_object->list, &channel->list_to_host);
 }
 
 static bool can_bus_off_recovery_pending(const struct can_channel *channel)
@@ -51,6 +51,10 @@ void USB_Handler(void)
 	HAL_PCD_IRQHandler(&hpcd_USB_FS);
 }
 
+#if defined(STM32F0) || defined(STM32F4)
+void CAN_Handler(void);
+#endif
+
 void Default_Handler(void)
 {
 	__asm__ ("BKPT");
@@ -112,7 +116,7 @@ const pFunc InterruptVectorTable[48] = {
 	0, // int 27: USART1
 	0, // int 28: USART2
 	0, // int 29: USART3_4
-	0, // int 30: CEC_CAN
+	CAN_Handler, // int 30: CEC_CAN
 	USB_Handler, // int 31: USB
 };
 
@@ -155,9 +159,9 @@ const pFunc InterruptVectorTable[84] = {
 	0,                    // int 16: DMA Stream 5
 	0,                    // int 17: DMA Stream 6
 	0,                    // int 18: ADCs
-	0,                    // int 19: CAN1 TX
-	0,                    // int 20: CAN1 RX0
-	0,                    // int 21: CAN1 RX1
+	CAN_Handler,          // int 19: CAN1 TX
+	CAN_Handler,          // int 20: CAN1 RX0
+	CAN_Handler,          // int 21: CAN1 RX1
 	0,                    // int 22: CAN1 SCE
 	0,                    // int 23: External Line [9:5]s
 	0,                    // int 24: TIM1 Break and TIM9
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "benchmark.h"
 #include "board.h"
 #include "can.h"
 #include "can_common.h"
@@ -34,6 +35,7 @@
 #include "device.h"
 #include "dfu.h"
 #include "gpio.h"
+#include "host_frame.h"
 #include "led.h"
 #include "timer.h"
 #include "usbd_conf.h"
@@ -44,7 +46,11 @@
 
 void initialise_monitor_handles(void);
 
-static USBD_GS_CAN_HandleTypeDef hGS_CAN;
+// free RAM between heap and stack, provided by the linker script
+extern uint8_t __frame_pool_start[];
+extern uint8_t __frame_pool_end[];
+
+static USBD_GS_CAN_HandleTypeDef hGS_CAN __ccm;
 static USBD_HandleTypeDef hUSB;
 
 int main(void)
@@ -58,12 +64,11 @@ int main(void)
 	gpio_init();
 	timer_init();
 
-	INIT_LIST_HEAD(&hGS_CAN.list_frame_pool);
-	INIT_LIST_HEAD(&hGS_CAN.list_to_host);
+	if (IS_ENABLED(CONFIG_BENCHMARK))
+		benchmark_run();
 
-	for (unsigned i = 0; i < ARRAY_SIZE(hGS_CAN.msgbuf); i++) {
-		list_add_tail(&hGS_CAN.msgbuf[i].list, &hGS_CAN.list_frame_pool);
-	}
+	gs_host_frame_pool_init(&hGS_CAN, __frame_pool_start, __frame_pool_end);
+	assert_basic(hGS_CAN.frame_pool.free > GS_HOST_FRAME_POOL_RESERVE);
 
 	for (unsigned int i = 0; i < ARRAY_SIZE(hGS_CAN.channels); i++) {
 		const struct board_channel_config *channel_config = &config.channel[i];
@@ -71,7 +76,11 @@ int main(void)
 
 		can_channel_set_nr(channel, i);
 
-		INIT_LIST_HEAD(&channel->list_from_host);
+		frame_ring_init(&channel->ring_from_host);
+		frame_heap_init(&channel->heap_from_host);
+		for (unsigned int j = 0; j < ARRAY_SIZE(channel->tx_slot); j++)
+			channel->tx_slot[j] = FRAME_RING_IDX_NONE;
+		INIT_LIST_HEAD(&channel->list_to_host);
 
 		led_init(&channel->leds,
 				 LEDRX_GPIO_Port, LEDRX_Pin, LEDRX_Active_High,
@@ -102,6 +111,7 @@ int main(void)
 
 		USBD_GS_CAN_ReceiveFromHost(&hUSB);
 		USBD_GS_CAN_SendToHost(&hUSB);
+		USBD_GS_CAN_SendStatus(&hUSB);
 
 		for (unsigned int i = 0; i < ARRAY_SIZE(hGS_CAN.channels); i++) {
 			can_data_t *channel = &hGS_CAN.channels[i];
@@ -30,6 +30,8 @@
 extern char __data_source[];
 extern char __data_start[];
 extern char __data_size[];
+extern char __ccm_start[];
+extern char __ccm_size[];
 
 void __initialize_hardware_early(void);
 void _start(void) __attribute__((noreturn));
@@ -39,6 +41,7 @@ void Reset_Handler(void)
 	__initialize_hardware_early();
 
 	memcpy(__data_start, __data_source, (uintptr_t)__data_size);
+	memset(__ccm_start, 0, (uintptr_t)__ccm_size);
 
 	_start();
 }
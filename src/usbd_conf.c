@@ -130,7 +130,7 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
 	pdev->pData = &hpcd_USB_FS;
 
 	hpcd_USB_FS.Instance = USB_INTERFACE;
-	hpcd_USB_FS.Init.dev_endpoints = 5U;
+	hpcd_USB_FS.Init.dev_endpoints = USBD_GS_CAN_NUM_PIPES > 1 ? 8U : 5U;
 	hpcd_USB_FS.Init.speed = PCD_SPEED_FULL;
 	hpcd_USB_FS.Init.ep0_mps = EP_MPS_64;
 	hpcd_USB_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
@@ -151,22 +151,43 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
 	HAL_PCD_Init(&hpcd_USB_FS);
 	/*
 	 * PMA layout
-	 *  0x00 -  0x17 (24 bytes) metadata?
-	 *  0x18 -  0x57 (64 bytes) EP0 OUT
-	 *  0x58 -  0x97 (64 bytes) EP0 IN
-	 *  0x98 -  0xD7 (64 bytes) EP1 IN
-	 *  0xD8 - 0x157 (128 bytes) EP1 OUT (buffer 1)
-	 * 0x158 - 0x1D7 (128 bytes) EP1 OUT (buffer 2)
+	 *  0x00 -  0x3F (64 bytes) buffer descriptor table
+	 *  0x40 -  0x7F (64 bytes) EP0 OUT
+	 *  0x80 -  0xBF (64 bytes) EP0 IN
+	 *  0xC0 -  0xFF (64 bytes) EP1 IN (buffer 1)
+	 * 0x100 - 0x13F (64 bytes) EP1 IN (buffer 2)
+	 * 0x140 - 0x1BF (128 bytes) EP2 OUT (buffer 1)
+	 * 0x1C0 - 0x23F (128 bytes) EP2 OUT (buffer 2)
+	 * 0x240 - 0x247 (8 bytes) EP3 IN
+	 * 0x248 - ...   (384 bytes each) further pipes, same layout as EP1/EP2
+	 *
+	 * The HAL uses the second IN buffer for multi packet transfers
+	 * only, to stage the next packet while the host reads the current
+	 * one.
 	 */
 #if defined(USB) || defined(USB_DRD_FS)
-	HAL_PCDEx_PMAConfig(pdev->pData, 0x00,				 PCD_SNG_BUF, 0x18);
-	HAL_PCDEx_PMAConfig(pdev->pData, 0x80,				 PCD_SNG_BUF, 0x58);
-	HAL_PCDEx_PMAConfig(pdev->pData, GSUSB_ENDPOINT_IN,	 PCD_SNG_BUF, 0x98);
-	HAL_PCDEx_PMAConfig(pdev->pData, GSUSB_ENDPOINT_OUT, PCD_DBL_BUF, 0x00D80158);
+	HAL_PCDEx_PMAConfig(pdev->pData, 0x00,					PCD_SNG_BUF, 0x40);
+	HAL_PCDEx_PMAConfig(pdev->pData, 0x80,					PCD_SNG_BUF, 0x80);
+	HAL_PCDEx_PMAConfig(pdev->pData, GSUSB_ENDPOINT_IN,		PCD_DBL_BUF, 0x010000C0);
+	HAL_PCDEx_PMAConfig(pdev->pData, GSUSB_ENDPOINT_OUT,	PCD_DBL_BUF, 0x01C00140);
+	HAL_PCDEx_PMAConfig(pdev->pData, GSUSB_ENDPOINT_STATUS, PCD_SNG_BUF, 0x240);
+
+	for (unsigned int nr = 1; nr < USBD_GS_CAN_NUM_PIPES; nr++) {
+		const uint32_t pma = 0x248 + (nr - 1) * 0x180;
+
+		HAL_PCDEx_PMAConfig(pdev->pData, USBD_GS_CAN_EP_IN(nr),	 PCD_DBL_BUF,
+							(pma + 0x040) << 16 | pma);
+		HAL_PCDEx_PMAConfig(pdev->pData, USBD_GS_CAN_EP_OUT(nr), PCD_DBL_BUF,
+							(pma + 0x100) << 16 | (pma + 0x080));
+	}
 #elif defined(USB_OTG_FS)
+	BUILD_BUG_ON(USBD_GS_CAN_NUM_PIPES > 1); // only 4 IN endpoints
+
 	HAL_PCDEx_SetRxFiFo(pdev->pData, USB_RX_FIFO_SIZE); // shared RX FIFO
 	HAL_PCDEx_SetTxFiFo(pdev->pData, 0U, 64U / 4U);     // 0x80, 64 bytes (div by 4 for words)
 	HAL_PCDEx_SetTxFiFo(pdev->pData, 1U, 64U / 4U);     // 0x81, 64 bytes (div by 4 for words)
+	HAL_PCDEx_SetTxFiFo(pdev->pData, 2U, 64U / 4U);     // 0x82, unused, minimum size
+	HAL_PCDEx_SetTxFiFo(pdev->pData, 3U, 64U / 4U);     // 0x83, 64 bytes (div by 4 for words)
 #endif
 
 	return USBD_OK;
@@ -33,6 +33,7 @@
 #include "config.h"
 #include "dfu.h"
 #include "gpio.h"
+#include "gs_host_frame_batch.h"
 #include "gs_usb.h"
 #include "host_frame.h"
 #include "led.h"
@@ -48,6 +49,23 @@
 
 static volatile bool is_usb_suspend_cb;
 
+/* Endpoint descriptors of the pipe of a further channel */
+#define USBD_GS_CAN_PIPE_DESC(nr) \
+	0x07,                             /* bLength */ \
+	USB_DESC_TYPE_ENDPOINT,           /* bDescriptorType */ \
+	USBD_GS_CAN_EP_IN(nr),            /* bEndpointAddress */ \
+	0x02,                             /* bmAttributes: bulk */ \
+	LOBYTE(CAN_DATA_MAX_PACKET_SIZE), /* wMaxPacketSize */ \
+	HIBYTE(CAN_DATA_MAX_PACKET_SIZE), \
+	0x00,                             /* bInterval: */ \
+	0x07,                             /* bLength */ \
+	USB_DESC_TYPE_ENDPOINT,           /* bDescriptorType */ \
+	USBD_GS_CAN_EP_OUT(nr),           /* bEndpointAddress */ \
+	0x02,                             /* bmAttributes: bulk */ \
+	LOBYTE(CAN_DATA_MAX_PACKET_SIZE), /* wMaxPacketSize */ \
+	HIBYTE(CAN_DATA_MAX_PACKET_SIZE), \
+	0x00,                             /* bInterval: */
+
 /* Configuration Descriptor */
 static const uint8_t USBD_GS_CAN_CfgDesc[USB_CAN_CONFIG_DESC_SIZ] =
 {
@@ -70,7 +88,7 @@ static const uint8_t USBD_GS_CAN_CfgDesc[USB_CAN_CONFIG_DESC_SIZ] =
 	USB_DESC_TYPE_INTERFACE,          /* bDescriptorType */
 	0x00,                             /* bInterfaceNumber */
 	0x00,                             /* bAlternateSetting */
-	0x02,                             /* bNumEndpoints */
+	1 + 2 * USBD_GS_CAN_NUM_PIPES,    /* bNumEndpoints */
 	0xFF,                             /* bInterfaceClass: Vendor Specific*/
 	0xFF,                             /* bInterfaceSubClass: Vendor Specific */
 	0xFF,                             /* bInterfaceProtocol: Vendor Specific */
@@ -99,6 +117,27 @@ static const uint8_t USBD_GS_CAN_CfgDesc[USB_CAN_CONFIG_DESC_SIZ] =
 	0x00,                             /* bInterval: */
 	/*---------------------------------------------------------------------------*/
 
+	/*---------------------------------------------------------------------------*/
+	/* EP3 descriptor */
+	0x07,                             /* bLength */
+	USB_DESC_TYPE_ENDPOINT,           /* bDescriptorType */
+	GSUSB_ENDPOINT_STATUS,            /* bEndpointAddress */
+	0x03,                             /* bmAttributes: interrupt */
+	LOBYTE(sizeof(struct gs_device_status)), /* wMaxPacketSize */
+	HIBYTE(sizeof(struct gs_device_status)),
+	0x01,                             /* bInterval: 1 ms */
+	/*---------------------------------------------------------------------------*/
+
+#if USBD_GS_CAN_NUM_PIPES > 1
+	USBD_GS_CAN_PIPE_DESC(1)
+#endif
+#if USBD_GS_CAN_NUM_PIPES > 2
+	USBD_GS_CAN_PIPE_DESC(2)
+#endif
+#if USBD_GS_CAN_NUM_PIPES > 3
+#error "Unsupported number of pipes"
+#endif
+
 	/*---------------------------------------------------------------------------*/
 	/* DFU Interface Descriptor */
 	/*---------------------------------------------------------------------------*/
@@ -216,51 +255,60 @@ static const struct gs_device_config USBD_GS_CAN_dconf = {
 	.hw_version = 1,
 };
 
-void usbd_gs_can_purge_from_host_list_by_channel(USBD_GS_CAN_HandleTypeDef *hcan,
-												 struct can_channel *channel)
-{
-	list_splice_tail_init_locked(&channel->list_from_host, &hcan->list_frame_pool);
-}
-
 void usbd_gs_can_purge_to_host_list_by_channel(USBD_GS_CAN_HandleTypeDef *hcan,
-											   const struct can_channel *channel)
+											   struct can_channel *channel)
 {
+	struct gs_host_frame_object *iter, *next;
+	LIST_HEAD(purge);
+
 	/*
-	 * If we only have one channel, all object of hcan->list_to_host belong to this one channel.
-	 * Move the complete list to the frame pool.
+	 * Detach the channel's list_to_host with IRQs disabled, then
+	 * return the objects one by one, so that the IRQs are only
+	 * disabled for a short time.
 	 */
-	if (NUM_CAN_CHANNEL == 1) {
-		list_splice_tail_init_locked(&hcan->list_to_host, &hcan->list_frame_pool);
+	bool was_irq_enabled = disable_irq();
+	list_splice_tail_init(&channel->list_to_host, &purge);
+	channel->to_host_deficit = 0;
+	restore_irq(was_irq_enabled);
 
-		return;
-	}
+	list_for_each_entry_safe(iter, next, &purge, list)
+		gs_host_frame_object_put_locked(hcan, iter);
+}
 
-	/*
-	 * For more than one channel, iterate over each object in hcan->list_to_host.
-	 */
-	struct gs_host_frame_object *iter, *next;
-	const uint8_t channel_nr = can_channel_get_nr(channel);
-	const bool was_irq_enabled = disable_irq();
+static void usbd_gs_can_purge_to_host_buf(USBD_GS_CAN_HandleTypeDef *hcan)
+{
+	bool was_irq_enabled = disable_irq();
+
+	for (unsigned int nr = 0; nr < ARRAY_SIZE(hcan->pipe); nr++) {
+		struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
 
-	list_for_each_entry_safe(iter, next, &hcan->list_to_host, list) {
-		if (gs_host_frame_object_get_channel_nr(iter) == channel_nr) {
-			list_move_tail(&iter->list, &hcan->list_frame_pool);
+		if (pipe->to_host_buf) {
+			gs_host_frame_object_put(hcan, pipe->to_host_buf);
+			pipe->to_host_buf = NULL;
 		}
+
+		pipe->to_host_len = 0;
+		pipe->to_host_zlp = false;
 	}
 
 	restore_irq(was_irq_enabled);
 }
 
-static void usbd_gs_can_purge_to_host_buf(USBD_GS_CAN_HandleTypeDef *hcan)
+static bool usbd_gs_can_to_host_busy(const struct usbd_gs_can_pipe *pipe)
 {
-	bool was_irq_enabled = disable_irq();
+	return pipe->to_host_buf || pipe->to_host_len || pipe->to_host_zlp;
+}
 
-	if (hcan->to_host_buf) {
-		list_add_tail(&hcan->to_host_buf->list, &hcan->list_frame_pool);
-		hcan->to_host_buf = NULL;
+// Return the pipe, the endpoint number (without direction bit) belongs to.
+static unsigned int usbd_gs_can_ep_to_pipe(uint8_t epnum)
+{
+	for (unsigned int nr = 1; nr < USBD_GS_CAN_NUM_PIPES; nr++) {
+		if (epnum == (USBD_GS_CAN_EP_IN(nr) & 0x7f) ||
+			epnum == USBD_GS_CAN_EP_OUT(nr))
+			return nr;
 	}
 
-	restore_irq(was_irq_enabled);
+	return 0;
 }
 
 /*
@@ -273,27 +321,37 @@ static void usbd_gs_can_purge_to_host_buf(USBD_GS_CAN_HandleTypeDef *hcan)
  * within other calls, which means the USB interrupt is already disabled and we
  * don't have any other interrupts to worry about.
  */
-static inline uint8_t USBD_GS_CAN_PrepareReceive(USBD_HandleTypeDef *pdev)
+static inline uint8_t USBD_GS_CAN_PrepareReceive(USBD_HandleTypeDef *pdev, unsigned int nr)
 {
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
-	struct gs_host_frame *frame = &hcan->from_host_buf[0]->frame;
-	uint16_t size;
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+	const unsigned int idx = (pipe->from_host_batch_head + pipe->from_host_batch_pending) %
+							 ARRAY_SIZE(pipe->buf->from_host_batch);
 
-	if (IS_ENABLED(CONFIG_CANFD)) {
-		size = struct_size(frame, canfd_ts, 1);
-	} else {
-		size = struct_size(frame, classic_can_ts, 1);
-	}
-
-	return USBD_LL_PrepareReceive(pdev, GSUSB_ENDPOINT_OUT, (uint8_t *)frame, size);
+	return USBD_LL_PrepareReceive(pdev, USBD_GS_CAN_EP_OUT(nr),
+								  pipe->buf->from_host_batch[idx],
+								  sizeof(pipe->buf->from_host_batch[idx]));
 }
 
 static uint8_t USBD_GS_CAN_Start(USBD_HandleTypeDef *pdev, uint8_t __maybe_unused cfgidx)
 {
-	assert_basic(pdev->pClassData);
-	USBD_LL_OpenEP(pdev, GSUSB_ENDPOINT_IN,	 USBD_EP_TYPE_BULK, CAN_DATA_MAX_PACKET_SIZE);
-	USBD_LL_OpenEP(pdev, GSUSB_ENDPOINT_OUT, USBD_EP_TYPE_BULK, CAN_DATA_MAX_PACKET_SIZE);
-	USBD_GS_CAN_PrepareReceive(pdev);
+	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+
+	assert_basic(hcan);
+	hcan->status_busy = false;
+
+	for (unsigned int nr = 0; nr < ARRAY_SIZE(hcan->pipe); nr++) {
+		struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+
+		pipe->from_host_batch_head = 0;
+		pipe->from_host_batch_pending = 0;
+
+		USBD_LL_OpenEP(pdev, USBD_GS_CAN_EP_IN(nr),	 USBD_EP_TYPE_BULK, CAN_DATA_MAX_PACKET_SIZE);
+		USBD_LL_OpenEP(pdev, USBD_GS_CAN_EP_OUT(nr), USBD_EP_TYPE_BULK, CAN_DATA_MAX_PACKET_SIZE);
+		USBD_GS_CAN_PrepareReceive(pdev, nr);
+	}
+
+	USBD_LL_OpenEP(pdev, GSUSB_ENDPOINT_STATUS, USBD_EP_TYPE_INTR, sizeof(struct gs_device_status));
 
 	return USBD_OK;
 }
@@ -305,8 +363,11 @@ static uint8_t USBD_GS_CAN_DeInit(USBD_HandleTypeDef *pdev, uint8_t __maybe_unus
 	usbd_gs_can_purge_to_host_buf(hcan);
 	is_usb_suspend_cb = false;
 
-	USBD_LL_CloseEP(pdev, GSUSB_ENDPOINT_IN);
-	USBD_LL_CloseEP(pdev, GSUSB_ENDPOINT_OUT);
+	for (unsigned int nr = 0; nr < ARRAY_SIZE(hcan->pipe); nr++) {
+		USBD_LL_CloseEP(pdev, USBD_GS_CAN_EP_IN(nr));
+		USBD_LL_CloseEP(pdev, USBD_GS_CAN_EP_OUT(nr));
+	}
+	USBD_LL_CloseEP(pdev, GSUSB_ENDPOINT_STATUS);
 
 	return USBD_OK;
 }
@@ -362,6 +423,8 @@ static uint8_t USBD_GS_CAN_Config_Request(USBD_HandleTypeDef *pdev, USBD_SetupRe
 	 * For all "per device" USB control messages
 	 * (GS_USB_BREQ_HOST_FORMAT and GS_USB_BREQ_DEVICE_CONFIG) the
 	 * Linux gs_usb driver uses a req->wValue = 1.
+	 * GS_USB_BREQ_GET_POOL_INFO is "per device", too, and ignores
+	 * req->wValue.
 	 *
 	 * All other control messages are "per channel" and specify the
 	 * channel number in req->wValue. So check req->wValue for valid
@@ -369,7 +432,8 @@ static uint8_t USBD_GS_CAN_Config_Request(USBD_HandleTypeDef *pdev, USBD_SetupRe
 	 *
 	 */
 	if (!(req->bRequest == GS_USB_BREQ_HOST_FORMAT ||
-		  req->bRequest == GS_USB_BREQ_DEVICE_CONFIG)) {
+		  req->bRequest == GS_USB_BREQ_DEVICE_CONFIG ||
+		  req->bRequest == GS_USB_BREQ_GET_POOL_INFO)) {
 		channel = USBD_GS_CAN_GetChannel(hcan, req->wValue);
 		if (!channel) {
 			goto out_fail;
@@ -471,6 +535,48 @@ static uint8_t USBD_GS_CAN_Config_Request(USBD_HandleTypeDef *pdev, USBD_SetupRe
 		case GS_USB_BREQ_BUS_OFF_RECOVERY:
 			len = 0;
 			break;
+		case GS_USB_BREQ_SET_TX_ECHO_INTERVAL:
+			len = sizeof(ep0->tx_echo_interval);
+			break;
+		case GS_USB_BREQ_SET_RX_FORMAT:
+			len = sizeof(ep0->rx_format);
+			break;
+		case GS_USB_BREQ_SET_POOL_QUOTA:
+			len = sizeof(ep0->pool_quota);
+			break;
+		case GS_USB_BREQ_SET_TX_COALESCE:
+			len = sizeof(ep0->tx_coalesce);
+			break;
+		case GS_USB_BREQ_TX_ABORT:
+			len = 0;
+			break;
+		case GS_USB_BREQ_GET_POOL_QUOTA:
+			ep0->pool_quota.min = channel->pool_quota_min;
+			ep0->pool_quota.max = channel->pool_quota_max;
+			src = &ep0->pool_quota;
+			len = sizeof(ep0->pool_quota);
+			break;
+		case GS_USB_BREQ_GET_POOL_INFO:
+			ep0->pool_info.size = hcan->msgbuf_count;
+			ep0->pool_info.size_fd = 0;
+#ifdef CONFIG_CANFD
+			ep0->pool_info.size_fd = hcan->msgbuf_fd_count;
+#endif
+			ep0->pool_info.ring_size = FRAME_RING_SIZE;
+			src = &ep0->pool_info;
+			len = sizeof(ep0->pool_info);
+			break;
+		case GS_USB_BREQ_GET_STATS:
+			ep0->stats.pool_used = channel->pool_used;
+			ep0->stats.pool_quota_hits = channel->pool_quota_hits;
+			ep0->stats.rx_dropped = channel->rx_dropped;
+			ep0->stats.err_dropped = channel->err_dropped;
+			ep0->stats.tx_expired = channel->tx_expired;
+			ep0->stats.tx_failed = channel->tx_failed;
+			ep0->stats.tx_rejected = channel->tx_rejected;
+			src = &ep0->stats;
+			len = sizeof(ep0->stats);
+			break;
 		default:
 			goto out_fail;
 	}
@@ -489,6 +595,11 @@ static uint8_t USBD_GS_CAN_Config_Request(USBD_HandleTypeDef *pdev, USBD_SetupRe
 		case GS_USB_BREQ_SET_FILTER:
 		case GS_USB_BREQ_SET_TDC:
 		case GS_USB_BREQ_BUS_OFF_RECOVERY:
+		case GS_USB_BREQ_SET_TX_ECHO_INTERVAL:
+		case GS_USB_BREQ_SET_RX_FORMAT:
+		case GS_USB_BREQ_SET_POOL_QUOTA:
+		case GS_USB_BREQ_SET_TX_COALESCE:
+		case GS_USB_BREQ_TX_ABORT:
 			if (req->wLength > sizeof(*ep0)) {
 				goto out_fail;
 			}
@@ -507,6 +618,9 @@ static uint8_t USBD_GS_CAN_Config_Request(USBD_HandleTypeDef *pdev, USBD_SetupRe
 		case GS_USB_BREQ_GET_FILTER:
 		case GS_USB_BREQ_GET_TDC_CONST:
 		case GS_USB_BREQ_GET_TDC:
+		case GS_USB_BREQ_GET_POOL_QUOTA:
+		case GS_USB_BREQ_GET_POOL_INFO:
+		case GS_USB_BREQ_GET_STATS:
 			USBD_CtlSendData(pdev, (uint8_t *)src, len);
 			break;
 		default:
@@ -567,6 +681,29 @@ static const led_seq_step_t led_identify_seq[] = {
 	{ .state = 0x00, .time_in_10ms = 0 }
 };
 
+// The minimum quotas of all channels must leave the overflow reserve
+// of the classic pool untouched.
+static bool usbd_gs_can_pool_quota_valid(const USBD_GS_CAN_HandleTypeDef *hcan,
+										 const can_data_t *channel,
+										 const struct gs_device_pool_quota *pool_quota)
+{
+	unsigned int min = pool_quota->min;
+
+	if (pool_quota->max == 0 ||
+		pool_quota->max > GS_HOST_FRAME_POOL_QUOTA_MAX ||
+		pool_quota->min > pool_quota->max)
+		return false;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan->channels); i++) {
+		const can_data_t *other = &hcan->channels[i];
+
+		if (other != channel)
+			min += other->pool_quota_min;
+	}
+
+	return min + GS_HOST_FRAME_POOL_RESERVE <= hcan->msgbuf_count;
+}
+
 static uint8_t USBD_GS_CAN_EP0_RxReady(USBD_HandleTypeDef *pdev) {
 
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
@@ -692,6 +829,69 @@ static uint8_t USBD_GS_CAN_EP0_RxReady(USBD_HandleTypeDef *pdev) {
 			can_schedule_bus_off_recovery(channel, 0);
 			break;
 
+		case GS_USB_BREQ_TX_ABORT:
+			if (!can_is_enabled(channel))
+				goto out_fail;
+
+			can_abort_tx(channel);
+			break;
+
+		case GS_USB_BREQ_SET_TX_ECHO_INTERVAL: {
+			const struct gs_device_tx_echo_interval *tx_echo_interval = &ep0->tx_echo_interval;
+
+			if (can_is_enabled(channel))
+				goto out_fail;
+
+			channel->tx_echo_interval = tx_echo_interval->interval;
+			break;
+		}
+
+		case GS_USB_BREQ_SET_RX_FORMAT: {
+			const struct gs_device_rx_format *rx_format = &ep0->rx_format;
+
+			if (can_is_enabled(channel))
+				goto out_fail;
+
+			switch (rx_format->format) {
+				case GS_DEVICE_RX_FORMAT_DEFAULT:
+				case GS_DEVICE_RX_FORMAT_COMPACT:
+					channel->rx_format = rx_format->format;
+					break;
+				default:
+					goto out_fail;
+			}
+			break;
+		}
+
+		case GS_USB_BREQ_SET_POOL_QUOTA: {
+			const struct gs_device_pool_quota *pool_quota = &ep0->pool_quota;
+
+			if (can_is_enabled(channel) ||
+				!usbd_gs_can_pool_quota_valid(hcan, channel, pool_quota))
+				goto out_fail;
+
+			channel->pool_quota_min = pool_quota->min;
+			channel->pool_quota_max = pool_quota->max;
+			break;
+		}
+
+		case GS_USB_BREQ_SET_TX_COALESCE: {
+			const struct gs_device_tx_coalesce *tx_coalesce = &ep0->tx_coalesce;
+
+			if (can_is_enabled(channel) ||
+				tx_coalesce->count > ARRAY_SIZE(tx_coalesce->can_id))
+				goto out_fail;
+
+			for (unsigned int i = 0; i < tx_coalesce->count; i++) {
+				channel->tx_coalesce[i] = (struct can_tx_coalesce){
+					.can_id = tx_coalesce->can_id[i],
+					.idx = FRAME_RING_IDX_NONE,
+				};
+			}
+			channel->tx_coalesce_count = tx_coalesce->count;
+			break;
+		}
+
 		default:
 			break;
 	}
@@ -703,114 +903,312 @@ out_fail:
 	return USBD_FAIL;
 }
 
-static uint8_t USBD_GS_CAN_DataIn(USBD_HandleTypeDef *pdev, uint8_t __maybe_unused epnum)
+static void USBD_GS_CAN_SendToHostPipe(USBD_HandleTypeDef *pdev, unsigned int nr);
+
+static uint8_t USBD_GS_CAN_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
 
-	bool was_irq_enabled = disable_irq();
-	list_add_tail(&hcan->to_host_buf->list, &hcan->list_frame_pool);
-	hcan->to_host_buf = NULL;
-	restore_irq(was_irq_enabled);
+	if (epnum == (GSUSB_ENDPOINT_STATUS & 0x7f)) {
+		hcan->status_busy = false;
+
+		return USBD_OK;
+	}
+
+	const unsigned int nr = usbd_gs_can_ep_to_pipe(epnum);
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+
+	if (pipe->to_host_zlp) {
+		pipe->to_host_zlp = false;
+	} else {
+		const uint16_t len = pipe->to_host_len;
+
+		pipe->to_host_len = 0;
+
+		if (pipe->to_host_buf) {
+			bool was_irq_enabled = disable_irq();
+			gs_host_frame_object_put(hcan, pipe->to_host_buf);
+			pipe->to_host_buf = NULL;
+			restore_irq(was_irq_enabled);
+		}
+
+		/* last packet was a full one, terminate transfer with a ZLP */
+		if (len && len % CAN_DATA_MAX_PACKET_SIZE == 0) {
+			pipe->to_host_zlp = true;
+			USBD_LL_Transmit(pdev, USBD_GS_CAN_EP_IN(nr), NULL, 0);
+
+			return USBD_OK;
+		}
+	}
+
+	// Arm the next transfer right away, instead of waiting for the
+	// main loop, to keep the IN endpoint busy.
+	USBD_GS_CAN_SendToHostPipe(pdev, nr);
 
 	return USBD_OK;
 }
 
-// Prefill the buffers from RX from host.
-// Return true if pre-allocated buffer list buffer list
-// was changed and is now ready, meaning and RX can be
-// re-enabled, false otherwise.
-// Must be called with IRQ disabled.
-static bool USBD_GS_Prefill_RX_Buffers(USBD_GS_CAN_HandleTypeDef *hcan)
+static bool usbd_gs_can_fd_is_trimmed(const can_data_t *channel,
+									  const struct gs_host_frame *frame)
 {
-	unsigned i;
-	bool changed;
+	return IS_ENABLED(CONFIG_CANFD) &&
+		   frame->flags & GS_CAN_FLAG_FD &&
+		   channel->feature & GS_CAN_FEATURE_FD_DLC_TRIM;
+}
 
-	changed = false;
-	for (i = 0; i < ARRAY_SIZE(hcan->from_host_buf); ++i) {
-		if (hcan->from_host_buf[i])
-			continue;
+// Return the size of the frame at the beginning of buf, or 0 if buf
+// doesn't hold a complete frame.
+static size_t usbd_gs_can_from_host_frame_size(USBD_GS_CAN_HandleTypeDef *hcan,
+											   const uint8_t *buf, size_t len)
+{
+	const struct gs_host_frame *frame = (const struct gs_host_frame *)buf;
+	const can_data_t *channel;
+	size_t size;
 
-		hcan->from_host_buf[i] = list_first_entry_or_null(&hcan->list_frame_pool,
-														  struct gs_host_frame_object,
-														  list);
-		if (!hcan->from_host_buf[i])
-			return false;
+	if (len < sizeof(*frame))
+		return 0;
+
+	channel = USBD_GS_CAN_GetChannel(hcan, frame->channel);
 
-		list_del(&hcan->from_host_buf[i]->list);
+	if (channel && usbd_gs_can_fd_is_trimmed(channel, frame))
+		size = offsetof(struct gs_host_frame, canfd) + gs_host_frame_batch_fd_data_len(frame);
+	else if (IS_ENABLED(CONFIG_CANFD) && frame->flags & GS_CAN_FLAG_FD)
+		size = struct_size(frame, canfd, 1);
+	else
+		size = struct_size(frame, classic_can, 1);
 
-		changed = true;
+	if (channel && channel->feature & GS_CAN_FEATURE_TX_DEADLINE)
+		size += sizeof(frame->classic_can_ts->timestamp_us);
+
+	if (len < size)
+		return 0;
+
+	return size;
+}
+
+// Return the length of the frames at the beginning of buf. Only
+// frames of channels started with GS_CAN_FEATURE_OUT_BATCH may be
+// followed by another one, legacy hosts may pad their transfers.
+static size_t usbd_gs_can_from_host_batch_len(USBD_GS_CAN_HandleTypeDef *hcan,
+											  const uint8_t *buf, size_t len)
+{
+	size_t offset = 0, size;
+
+	while ((size = usbd_gs_can_from_host_frame_size(hcan, buf + offset, len - offset))) {
+		const struct gs_host_frame *frame = (const struct gs_host_frame *)(buf + offset);
+		const can_data_t *channel = USBD_GS_CAN_GetChannel(hcan, frame->channel);
+
+		offset += size;
+
+		if (!channel || !(channel->feature & GS_CAN_FEATURE_OUT_BATCH))
+			break;
 	}
 
-	return changed;
+	return offset;
 }
 
-// Note that the return value is completely ignored by the stack.
-static uint8_t USBD_GS_CAN_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum) {
-	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
-	can_data_t *channel;
+// Move the deadline of a frame from the host to the timestamp of the
+// frame object and make it absolute, see GS_CAN_FEATURE_TX_DEADLINE.
+static void usbd_gs_can_from_host_deadline(const can_data_t *channel,
+										   struct gs_host_frame *frame,
+										   uint32_t now)
+{
+	uint32_t *deadline = IS_ENABLED(CONFIG_CANFD) && frame->flags & GS_CAN_FLAG_FD ?
+						 &frame->canfd_ts->timestamp_us :
+						 &frame->classic_can_ts->timestamp_us;
+
+	if (usbd_gs_can_fd_is_trimmed(channel, frame))
+		memmove(deadline, &frame->canfd->data[gs_host_frame_batch_fd_data_len(frame)],
+				sizeof(*deadline));
 
-	/* If we do not have a valid incoming frame pointer, something broke. */
-	assert_basic(hcan->from_host_buf[0]);
+	if (*deadline && !(frame->flags & GS_CAN_FLAG_TX_DEADLINE_ABS)) {
+		*deadline += now;
 
-	uint32_t rxlen = USBD_LL_GetRxDataSize(pdev, epnum);
-	if (rxlen < (struct_size(&hcan->from_host_buf[0]->frame, classic_can, 1))) {
-		// Invalid frame length, just ignore it and receive into the same buffer
-		// again next time.
-		goto out_prepare_receive;
+		// 0 means no deadline
+		if (!*deadline)
+			*deadline = 1;
 	}
 
-	channel = USBD_GS_CAN_GetChannel(hcan, hcan->from_host_buf[0]->frame.channel);
-	if (!channel) {
-		goto out_prepare_receive;
+	frame->flags &= ~GS_CAN_FLAG_TX_DEADLINE_ABS;
+}
+
+// Return true if a started channel other than channel exchanges its
+// frames over pipe nr, too.
+static bool usbd_gs_can_pipe_is_shared(const USBD_GS_CAN_HandleTypeDef *hcan,
+									   unsigned int nr, const can_data_t *channel)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan->channels); i++) {
+		const can_data_t *other = &hcan->channels[i];
+
+		if (other != channel && can_is_enabled(other) &&
+			gs_host_frame_to_host_pipe_nr(other) == nr)
+			return true;
 	}
 
-	if (IS_ENABLED(CONFIG_CANFD) &&
-		hcan->from_host_buf[0]->frame.flags & GS_CAN_FLAG_FD &&
-		rxlen < struct_size(&hcan->from_host_buf[0]->frame, canfd, 1)) {
-		goto out_prepare_receive;
+	return false;
+}
+
+// Echo a frame from the host, that its channel has no room for, as
+// aborted right away. Must be called with IRQ disabled.
+static void usbd_gs_can_from_host_reject(can_data_t *channel,
+										 struct gs_host_frame_object *frame_object,
+										 uint32_t now)
+{
+	struct gs_host_frame *frame = &frame_object->frame;
+
+	channel->tx_rejected++;
+	frame->flags = (frame->flags & ~GS_CAN_FLAG_TX_DEADLINE_ABS) | GS_CAN_FLAG_TX_ABORTED;
+	frame->reserved = 0x0;
+	if (gs_host_frame_is_fd(frame))
+		frame->canfd_ts->timestamp_us = now;
+	else
+		frame->classic_can_ts->timestamp_us = now;
+
+	list_add_tail(&frame_object->list, &channel->list_to_host);
+}
+
+// Split a transfer received over pipe nr into frame objects and queue
+// them to their channel. If a channel's quota is exhausted or its
+// ring is full, while other started channels share the pipe, its
+// frames are echoed as aborted, so that it doesn't block the pipe.
+// Otherwise either all or no frames are queued, return false if the
+// frame pool is too short, a channel's quota is exhausted or its ring
+// is full. Must be called with IRQ disabled.
+static bool USBD_GS_CAN_DispatchBatch(USBD_GS_CAN_HandleTypeDef *hcan, unsigned int nr,
+									  const uint8_t *buf, size_t len)
+{
+	unsigned int queued[NUM_CAN_CHANNEL] = { 0 };
+	bool full[NUM_CAN_CHANNEL] = { false };
+	const uint32_t now = timer_get();
+	LIST_HEAD(reserved);
+	size_t offset, size;
+
+	len = usbd_gs_can_from_host_batch_len(hcan, buf, len);
+
+	for (offset = 0; (size = usbd_gs_can_from_host_frame_size(hcan, buf + offset, len - offset)); offset += size) {
+		const struct gs_host_frame *frame = (const struct gs_host_frame *)(buf + offset);
+		const bool fd = gs_host_frame_is_fd(frame);
+		can_data_t *channel = USBD_GS_CAN_GetChannel(hcan, frame->channel);
+		struct gs_host_frame_object *frame_object = NULL;
+
+		if (!channel)
+			continue;
+
+		// once full, the later frames of a channel are rejected, too
+		if (!full[frame->channel]) {
+			if (queued[frame->channel] < frame_ring_space(&channel->ring_from_host))
+				frame_object = __gs_host_frame_object_get(hcan, channel, fd,
+														  gs_host_frame_pool_reserve(fd),
+														  true);
+			if (frame_object) {
+				queued[frame->channel]++;
+				list_add_tail(&frame_object->list, &reserved);
+				continue;
+			}
+
+			if (!usbd_gs_can_pipe_is_shared(hcan, nr, channel)) {
+				gs_host_frame_object_put_list(hcan, &reserved);
+				return false;
+			}
+
+			full[frame->channel] = true;
+		}
+
+		// the echo of a rejected frame isn't limited by the quota
+		frame_object = __gs_host_frame_object_get(hcan, channel, fd,
+												  gs_host_frame_pool_reserve(fd),
+												  false);
+		if (!frame_object) {
+			gs_host_frame_object_put_list(hcan, &reserved);
+			return false;
+		}
+
+		list_add_tail(&frame_object->list, &reserved);
 	}
 
-	bool was_irq_enabled = disable_irq();
-	// Enqueue the frame we just received.
-	list_add_tail(&hcan->from_host_buf[0]->list, &channel->list_from_host);
+	for (offset = 0; (size = usbd_gs_can_from_host_frame_size(hcan, buf + offset, len - offset)); offset += size) {
+		const struct gs_host_frame *frame = (const struct gs_host_frame *)(buf + offset);
+		can_data_t *channel = USBD_GS_CAN_GetChannel(hcan, frame->channel);
+		struct gs_host_frame_object *frame_object;
 
-	int last;
-	for (last = 0; last < (int)ARRAY_SIZE(hcan->from_host_buf) - 1; ++last)
-		hcan->from_host_buf[last] = hcan->from_host_buf[last + 1];
-	hcan->from_host_buf[last] = NULL;
+		if (!channel)
+			continue;
 
-	bool rx_ready = USBD_GS_Prefill_RX_Buffers(hcan);
+		frame_object = list_first_entry(&reserved, struct gs_host_frame_object, list);
+		memcpy(frame_object->_buf, frame, size);
+		list_del(&frame_object->list);
 
-	if (rx_ready) {
-		restore_irq(was_irq_enabled);
+		if (!queued[frame->channel]) {
+			usbd_gs_can_from_host_reject(channel, frame_object, now);
+			continue;
+		}
 
-		// All RX buffers are ready. Enable RX.
-		USBD_GS_CAN_PrepareReceive(pdev);
-	} else {
-		restore_irq(was_irq_enabled);
+		queued[frame->channel]--;
+		if (channel->feature & GS_CAN_FEATURE_TX_DEADLINE)
+			usbd_gs_can_from_host_deadline(channel, &frame_object->frame, now);
+		frame_ring_push(&channel->ring_from_host,
+						gs_host_frame_object_to_idx(hcan, frame_object));
+	}
 
-#if defined(USB) || defined(USB_DRD_FS)
-		// Not all RX buffers are ready. We got enough in the
-		// pre-allocated reserve to ensure callbacks which are going
-		// to be called due to USB frames being received into double
-		// buffer, but disable further RX. If double buffer not in use,
-		// RX would have already been disabled by USB HW.
-		USBD_GS_CAN_PrepareReceive(pdev);
-		PCD_SET_EP_RX_STATUS(((PCD_HandleTypeDef *)pdev->pData)->Instance,
-							 GSUSB_ENDPOINT_OUT,
-							 USB_EP_RX_NAK);
-#endif
+	return true;
+}
+
+// Dispatch the received, but not yet queued transfers of pipe nr in
+// order. Must be called with IRQ disabled.
+static void USBD_GS_CAN_DispatchPending(USBD_GS_CAN_HandleTypeDef *hcan,
+										unsigned int nr)
+{
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+
+	while (pipe->from_host_batch_pending) {
+		const unsigned int idx = pipe->from_host_batch_head;
+
+		if (!USBD_GS_CAN_DispatchBatch(hcan, nr, pipe->buf->from_host_batch[idx],
+									   pipe->from_host_batch_len[idx]))
+			return;
+
+		pipe->from_host_batch_head = (idx + 1) % ARRAY_SIZE(pipe->buf->from_host_batch);
+		pipe->from_host_batch_pending--;
 	}
-	return USBD_OK;
+}
 
-out_prepare_receive:
-	// We can not unconditionally re-enable RX if the pre-allocated
-	// buffers are not fully ready.
-	for (unsigned i = 0; i < ARRAY_SIZE(hcan->from_host_buf); ++i) {
-		if (!hcan->from_host_buf[i])
-			return USBD_OK;
+// Note that the return value is completely ignored by the stack.
+static uint8_t USBD_GS_CAN_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum) {
+	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+	const unsigned int nr = usbd_gs_can_ep_to_pipe(epnum);
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+	const unsigned int idx = (pipe->from_host_batch_head + pipe->from_host_batch_pending) %
+							 ARRAY_SIZE(pipe->buf->from_host_batch);
+
+	/* If we receive with all buffers pending, something broke. */
+	assert_basic(pipe->from_host_batch_pending < ARRAY_SIZE(pipe->buf->from_host_batch));
+
+	pipe->from_host_batch_len[idx] = USBD_LL_GetRxDataSize(pdev, epnum);
+	pipe->from_host_batch_pending++;
+
+	USBD_GS_CAN_DispatchPending(hcan, nr);
+
+	if (!pipe->from_host_batch_pending) {
+		// All RX buffers are free. Enable RX.
+		USBD_GS_CAN_PrepareReceive(pdev, nr);
+
+		return USBD_OK;
 	}
-	USBD_GS_CAN_PrepareReceive(pdev);
+
+	if (pipe->from_host_batch_pending == ARRAY_SIZE(pipe->buf->from_host_batch))
+		return USBD_OK;
+
+#if defined(USB) || defined(USB_DRD_FS)
+	// Not all frames could be queued. We got a spare buffer to
+	// ensure callbacks which are going to be called due to USB
+	// frames being received into double buffer, but disable
+	// further RX. If double buffer not in use, RX would have
+	// already been disabled by USB HW.
+	USBD_GS_CAN_PrepareReceive(pdev, nr);
+	PCD_SET_EP_RX_STATUS(((PCD_HandleTypeDef *)pdev->pData)->Instance,
+						 USBD_GS_CAN_EP_OUT(nr),
+						 USB_EP_RX_NAK);
+#endif
 
 	return USBD_OK;
 }
@@ -872,6 +1270,11 @@ USBD_ClassTypeDef USBD_GS_CAN = {
 
 uint8_t USBD_GS_CAN_Init(USBD_GS_CAN_HandleTypeDef *hcan, USBD_HandleTypeDef *pdev)
 {
+	static struct usbd_gs_can_pipe_buf pipe_buf[USBD_GS_CAN_NUM_PIPES];
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan->pipe); i++)
+		hcan->pipe[i].buf = &pipe_buf[i];
+
 	pdev->pClassData = hcan;
 
 	return USBD_OK;
@@ -911,52 +1314,69 @@ void USBD_GS_CAN_ReceiveFromHost(USBD_HandleTypeDef *pdev)
 
 	bool was_irq_enabled = disable_irq();
 
-	// Reserve the multiple RX buffers we need to ensure no frame loss
-	// with OUT endpoint double-buffering before (re)starting the RX. */
-	bool rx_ready = USBD_GS_Prefill_RX_Buffers(hcan);
+	// Queue the transfers that didn't fit into the frame pool,
+	// before (re)starting the RX.
+	for (unsigned int nr = 0; nr < ARRAY_SIZE(hcan->pipe); nr++) {
+		struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+
+		if (!pipe->from_host_batch_pending)
+			continue;
 
-	if (rx_ready)
-		USBD_GS_CAN_PrepareReceive(pdev);
+		USBD_GS_CAN_DispatchPending(hcan, nr);
+
+		if (!pipe->from_host_batch_pending)
+			USBD_GS_CAN_PrepareReceive(pdev, nr);
+	}
 
 	restore_irq(was_irq_enabled);
 }
 
-static uint8_t USBD_GS_CAN_Transmit(USBD_HandleTypeDef *pdev, uint8_t *buf, uint16_t len)
+static uint8_t USBD_GS_CAN_Transmit(USBD_HandleTypeDef *pdev, unsigned int nr,
+									uint8_t *buf, uint16_t len)
 {
 	if (false == is_usb_suspend_cb) {
-		USBD_LL_Transmit(pdev, GSUSB_ENDPOINT_IN, buf, len);
+		USBD_LL_Transmit(pdev, USBD_GS_CAN_EP_IN(nr), buf, len);
 		return USBD_OK;
 	} else {
 		return USBD_BUSY;
 	}
 }
 
-static uint8_t USBD_GS_CAN_SendFrame(USBD_HandleTypeDef *pdev,
+static size_t usbd_gs_can_frame_size(const can_data_t *channel,
+									 const struct gs_host_frame *frame)
+{
+	return gs_host_frame_batch_frame_size(channel->feature, gs_host_frame_is_fd(frame), frame);
+}
+
+// Move the timestamp of a trimmed CAN-FD frame directly behind its
+// data, so that the frame can be sent with usbd_gs_can_frame_size().
+static void usbd_gs_can_frame_trim(const can_data_t *channel,
+								   struct gs_host_frame *frame)
+{
+	if (!usbd_gs_can_fd_is_trimmed(channel, frame) ||
+		!(channel->feature & GS_CAN_FEATURE_HW_TIMESTAMP))
+		return;
+
+	memmove(&frame->canfd->data[gs_host_frame_batch_fd_data_len(frame)],
+			&frame->canfd_ts->timestamp_us,
+			sizeof(frame->canfd_ts->timestamp_us));
+}
+
+static uint8_t USBD_GS_CAN_SendFrame(USBD_HandleTypeDef *pdev, unsigned int nr,
 									 struct gs_host_frame_object *frame_object)
 {
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
 	const can_data_t *channel = gs_host_frame_object_get_channel(hcan, frame_object);
-	const struct gs_host_frame *frame = &frame_object->frame;
+	struct gs_host_frame *frame = &frame_object->frame;
 	uint8_t buf[CAN_DATA_MAX_PACKET_SIZE];
 	uint8_t *send_addr;
 	size_t len;
 
-	if (IS_ENABLED(CONFIG_CANFD) &&
-		frame->flags & GS_CAN_FLAG_FD) {
-		if (channel->feature & GS_CAN_FEATURE_HW_TIMESTAMP) {
-			len = struct_size(frame, canfd_ts, 1);
-		} else {
-			len = struct_size(frame, canfd, 1);
-		}
-	} else {
-		if (channel->feature & GS_CAN_FEATURE_HW_TIMESTAMP) {
-			len = struct_size(frame, classic_can_ts, 1);
-		} else {
-			len = struct_size(frame, classic_can, 1);
-		}
-	}
-
+	usbd_gs_can_frame_trim(channel, frame);
+	len = usbd_gs_can_frame_size(channel, frame);
 	send_addr = (uint8_t *)frame;
+	pipe->to_host_len = len;
 
 	/*
 	 * When talking to WinUSB it seems to help a lot if the size of
@@ -976,33 +1396,199 @@ static uint8_t USBD_GS_CAN_SendFrame(USBD_HandleTypeDef *pdev,
 		memset(buf + len, 0, sizeof(buf) - len);
 		send_addr = buf;
 		len = sizeof(buf);
+
+		// the host reads packets of this size, no ZLP
+		pipe->to_host_len = 0;
 	}
 
-	return USBD_GS_CAN_Transmit(pdev, send_addr, len);
+	uint8_t result = USBD_GS_CAN_Transmit(pdev, nr, send_addr, len);
+	if (result != USBD_OK)
+		pipe->to_host_len = 0;
+
+	return result;
 }
 
-void USBD_GS_CAN_SendToHost(USBD_HandleTypeDef *pdev)
+static bool usbd_gs_can_is_compact(const can_data_t *channel)
+{
+	return channel->rx_format == GS_DEVICE_RX_FORMAT_COMPACT;
+}
+
+// Size of a frame on the IN endpoint, for compact records the upper
+// bound.
+static size_t usbd_gs_can_to_host_size(const can_data_t *channel,
+									   const struct gs_host_frame *frame)
+{
+	if (usbd_gs_can_is_compact(channel))
+		return gs_host_frame_compact_size_max(gs_host_frame_data_len(frame));
+
+	return usbd_gs_can_frame_size(channel, frame);
+}
+
+/*
+ * The channels sharing a pipe are served by deficit round robin:
+ * on its turn a channel is credited USBD_GS_CAN_TO_HOST_QUANTUM
+ * bytes and may send frames as long as its credit lasts. This shares
+ * the IN bandwidth by bytes rather than by frames, so a busy CAN-FD
+ * channel cannot starve a classic CAN channel. The quantum holds at
+ * least one frame of any size, so every channel with pending frames
+ * gets to send at least one per round.
+ */
+#define USBD_GS_CAN_TO_HOST_QUANTUM (2 * GS_HOST_FRAME_SIZE)
+
+// Return the next frame object of pipe nr to send, without removing
+// it from its list_to_host, or NULL if there is none. Must be called
+// with IRQ disabled.
+static struct gs_host_frame_object *
+usbd_gs_can_to_host_peek(USBD_GS_CAN_HandleTypeDef *hcan, unsigned int nr,
+						 size_t *size)
+{
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+
+	BUILD_BUG_ON(USBD_GS_CAN_TO_HOST_QUANTUM < GS_HOST_FRAME_SIZE);
+
+	// the current channel plus one full round
+	for (unsigned int i = 0; i <= NUM_CAN_CHANNEL; i++) {
+		can_data_t *channel = &hcan->channels[pipe->to_host_next];
+
+		if (gs_host_frame_to_host_pipe_nr(channel) == nr) {
+			struct gs_host_frame_object *frame_object =
+				list_first_entry_or_null(&channel->list_to_host,
+										 struct gs_host_frame_object,
+										 list);
+
+			if (frame_object) {
+				*size = usbd_gs_can_to_host_size(channel, &frame_object->frame);
+				if (*size <= channel->to_host_deficit)
+					return frame_object;
+			} else {
+				// an idle channel doesn't save up credit
+				channel->to_host_deficit = 0;
+			}
+		}
+
+		pipe->to_host_next = (pipe->to_host_next + 1) % NUM_CAN_CHANNEL;
+		channel = &hcan->channels[pipe->to_host_next];
+		if (gs_host_frame_to_host_pipe_nr(channel) == nr)
+			channel->to_host_deficit += USBD_GS_CAN_TO_HOST_QUANTUM;
+	}
+
+	return NULL;
+}
+
+// Remove a frame object returned by usbd_gs_can_to_host_peek() from
+// its list_to_host and charge its size to the channel's credit. Must
+// be called with IRQ disabled.
+static void usbd_gs_can_to_host_pop(USBD_GS_CAN_HandleTypeDef *hcan,
+									struct gs_host_frame_object *frame_object,
+									size_t size)
+{
+	can_data_t *channel = gs_host_frame_object_get_channel(hcan, frame_object);
+
+	channel->to_host_deficit -= size;
+	list_del(&frame_object->list);
+}
+
+// Move as many frames of pipe nr to batch as fit into
+// pipe->buf->to_host_batch. Stops at the first frame of a channel without
+// GS_CAN_FEATURE_IN_BATCH. Compact records are always sent in
+// batches, their size is estimated by the upper bound. Must be
+// called with IRQ disabled.
+static void USBD_GS_CAN_CollectBatch(USBD_GS_CAN_HandleTypeDef *hcan,
+									 unsigned int nr,
+									 struct list_head *batch)
+{
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+	struct gs_host_frame_object *frame_object;
+	size_t len = 0, size;
+
+	while ((frame_object = usbd_gs_can_to_host_peek(hcan, nr, &size))) {
+		const can_data_t *channel = gs_host_frame_object_get_channel(hcan, frame_object);
+
+		if (!usbd_gs_can_is_compact(channel) &&
+			!(channel->feature & GS_CAN_FEATURE_IN_BATCH))
+			break;
+
+		if (len + size > sizeof(pipe->buf->to_host_batch))
+			break;
+
+		usbd_gs_can_to_host_pop(hcan, frame_object, size);
+		list_add_tail(&frame_object->list, batch);
+		len += size;
+	}
+}
+
+static uint8_t USBD_GS_CAN_SendBatch(USBD_HandleTypeDef *pdev, unsigned int nr,
+									 struct list_head *batch)
+{
+	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+	struct gs_host_frame_object *iter;
+	uint16_t len = 0;
+
+	BUILD_BUG_ON(sizeof(pipe->buf->to_host_batch) > GS_HOST_FRAME_BATCH_SIZE_MAX);
+
+	list_for_each_entry(iter, batch, list) {
+		can_data_t *channel = gs_host_frame_object_get_channel(hcan, iter);
+
+		if (usbd_gs_can_is_compact(channel)) {
+			len += gs_host_frame_compact_encode(&iter->frame,
+												gs_host_frame_is_fd(&iter->frame),
+												can_channel_get_nr(channel),
+												&channel->rx_compact_ts,
+												&pipe->buf->to_host_batch[len]);
+			continue;
+		}
+
+		const size_t frame_len = usbd_gs_can_frame_size(channel, &iter->frame);
+
+		usbd_gs_can_frame_trim(channel, &iter->frame);
+		memcpy(&pipe->buf->to_host_batch[len], &iter->frame, frame_len);
+		len += frame_len;
+	}
+
+	// The frames have been copied, so return them to the pool right away.
+	gs_host_frame_object_put_list_locked(hcan, batch);
+
+	pipe->to_host_len = len;
+
+	uint8_t result = USBD_GS_CAN_Transmit(pdev, nr, pipe->buf->to_host_batch, len);
+	if (result != USBD_OK)
+		pipe->to_host_len = 0;
+
+	return result;
+}
+
+// Start the next IN transfer of a pipe if its endpoint is idle.
+static void USBD_GS_CAN_SendToHostPipe(USBD_HandleTypeDef *pdev, unsigned int nr)
 {
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+	struct usbd_gs_can_pipe *pipe = &hcan->pipe[nr];
+	LIST_HEAD(batch);
 
 	bool was_irq_enabled = disable_irq();
-	if (hcan->to_host_buf) {
+	if (usbd_gs_can_to_host_busy(pipe)) {
+		restore_irq(was_irq_enabled);
+		return;
+	}
+
+	USBD_GS_CAN_CollectBatch(hcan, nr, &batch);
+	if (!list_empty(&batch)) {
 		restore_irq(was_irq_enabled);
+		USBD_GS_CAN_SendBatch(pdev, nr, &batch);
 		return;
 	}
 
-	hcan->to_host_buf = list_first_entry_or_null(&hcan->list_to_host,
-												 struct gs_host_frame_object,
-												 list);
-	if (!hcan->to_host_buf) {
+	size_t size;
+	pipe->to_host_buf = usbd_gs_can_to_host_peek(hcan, nr, &size);
+	if (!pipe->to_host_buf) {
 		restore_irq(was_irq_enabled);
 		return;
 	}
 
-	list_del(&hcan->to_host_buf->list);
+	usbd_gs_can_to_host_pop(hcan, pipe->to_host_buf, size);
 	restore_irq(was_irq_enabled);
 
-	uint8_t result = USBD_GS_CAN_SendFrame(pdev, hcan->to_host_buf);
+	uint8_t result = USBD_GS_CAN_SendFrame(pdev, nr, pipe->to_host_buf);
 	if (result == USBD_OK)
 		return;
 
@@ -1010,17 +1596,27 @@ void USBD_GS_CAN_SendToHost(USBD_HandleTypeDef *pdev)
 	 * If USBD_GS_CAN_SendFrame() fails, it will be due to a USB suspend event
 	 * (is_usb_suspend_cb == true).
 	 * For now the firmware shuts down the CAN interface during suspend and
-	 * hcan->to_host_buf is pruged by usbd_gs_can_purge_to_host_buf() during
+	 * pipe->to_host_buf is pruged by usbd_gs_can_purge_to_host_buf() during
 	 * USBD_GS_CAN_DeInit().
 	 */
 	was_irq_enabled = disable_irq();
-	if (hcan->to_host_buf) {
-		list_add_tail(&hcan->to_host_buf->list, &hcan->list_frame_pool);
-		hcan->to_host_buf = NULL;
+	if (pipe->to_host_buf) {
+		gs_host_frame_object_put(hcan, pipe->to_host_buf);
+		pipe->to_host_buf = NULL;
 	}
 	restore_irq(was_irq_enabled);
 }
 
+// Start the next IN transfers of all idle pipes. Called from the main
+// loop, the DataIn completion interrupt takes care of its own pipe.
+void USBD_GS_CAN_SendToHost(USBD_HandleTypeDef *pdev)
+{
+	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+
+	for (unsigned int nr = 0; nr < ARRAY_SIZE(hcan->pipe); nr++)
+		USBD_GS_CAN_SendToHostPipe(pdev, nr);
+}
+
 bool USBD_GS_CAN_DfuDetachRequested(USBD_HandleTypeDef *pdev)
 {
 	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
@@ -1047,3 +1643,59 @@ void USBD_GS_CAN_ResumeCallback(USBD_HandleTypeDef __maybe_unused *pdev)
 {
 	is_usb_suspend_cb = false;
 }
+
+static void usbd_gs_can_get_status(USBD_GS_CAN_HandleTypeDef *hcan,
+								   const can_data_t *channel,
+								   struct gs_device_status *status)
+{
+	struct gs_device_state state;
+
+	can_get_device_state(channel, &state);
+
+	status->channel = can_channel_get_nr(channel);
+	status->state = state.state;
+	status->rxerr = state.rxerr;
+	status->txerr = state.txerr;
+
+	bool was_irq_enabled = disable_irq();
+	status->pool_free = gs_host_frame_pool_free(hcan);
+	status->from_host_depth = frame_ring_count(&channel->ring_from_host);
+	restore_irq(was_irq_enabled);
+}
+
+// Send the status of the next channel that changed since its last
+// status was sent. Checked once per ms, the interval of the endpoint.
+void USBD_GS_CAN_SendStatus(USBD_HandleTypeDef *pdev)
+{
+	USBD_GS_CAN_HandleTypeDef *hcan = pdev->pClassData;
+	const uint32_t now = HAL_GetTick();
+
+	if (hcan->status_busy || hcan->status_tick == now || is_usb_suspend_cb)
+		return;
+
+	hcan->status_tick = now;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan->channels); i++) {
+		const unsigned int nr = (hcan->status_next + i) % ARRAY_SIZE(hcan->channels);
+		const can_data_t *channel = &hcan->channels[nr];
+		struct gs_device_status *last = &hcan->status[nr];
+		struct gs_device_status status;
+
+		// invalidate the last status, so that it's sent on start
+		if (!(channel->feature & GS_CAN_FEATURE_STATUS_EP)) {
+			memset(last, 0xff, sizeof(*last));
+			continue;
+		}
+
+		usbd_gs_can_get_status(hcan, channel, &status);
+		if (!memcmp(&status, last, sizeof(status)))
+			continue;
+
+		*last = status;
+		hcan->status_next = nr + 1;
+		hcan->status_busy = true;
+		USBD_LL_Transmit(pdev, GSUSB_ENDPOINT_STATUS, (uint8_t *)last, sizeof(*last));
+
+		return;
+	}
+}
@@ -0,0 +1,198 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Stubs of the functions src/usbd_gs_can.c calls besides the bulk IN
+ * endpoint, i.e. for control requests, the OUT endpoint and the CAN
+ * controller. The host tests don't get there. USBD_LL_Transmit() is up
+ * to the test.
+ */
+
+#include <stdlib.h>
+
+#include "can.h"
+#include "can_common.h"
+#include "gpio.h"
+#include "led.h"
+#include "timer.h"
+#include "usbd_core.h"
+#include "usbd_ctlreq.h"
+#include "usbd_ioreq.h"
+#include "util.h"
+
+const struct gs_device_bt_const CAN_btconst;
+const struct gs_device_bt_const_extended CAN_btconst_ext;
+const struct gs_device_tdc_const CAN_tdc_const;
+const struct gs_device_filter_info CAN_filter_info;
+
+uint8_t USBD_DescBuf[USBD_DESC_BUF_SIZE];
+
+void assert_failed(void)
+{
+	abort();
+}
+
+uint32_t HAL_GetTick(void)
+{
+	abort();
+}
+
+void USBD_CtlError(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+	abort();
+}
+
+USBD_StatusTypeDef USBD_CtlPrepareRx(USBD_HandleTypeDef *pdev, uint8_t *pbuf, uint16_t len)
+{
+	abort();
+}
+
+USBD_StatusTypeDef USBD_CtlSendData(USBD_HandleTypeDef *pdev, uint8_t *pbuf, uint16_t len)
+{
+	abort();
+}
+
+void USBD_GetString(uint8_t *desc, uint8_t *unicode, uint16_t *len)
+{
+	abort();
+}
+
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr,
+								  uint8_t ep_type, uint16_t ep_mps)
+{
+	abort();
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+	abort();
+}
+
+USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev, uint8_t ep_addr,
+										  uint8_t *pbuf, uint16_t size)
+{
+	abort();
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+	abort();
+}
+
+uint32_t timer_get(void)
+{
+	abort();
+}
+
+bool can_is_enabled(const struct can_channel *channel)
+{
+	return channel->state < GS_CAN_STATE_STOPPED;
+}
+
+void can_enable(struct can_channel *channel, uint32_t mode)
+{
+	abort();
+}
+
+void can_disable(USBD_GS_CAN_HandleTypeDef *hcan, struct can_channel *channel)
+{
+	abort();
+}
+
+void can_abort_tx(struct can_channel *channel)
+{
+	abort();
+}
+
+bool can_check_feature_ok(const can_data_t *channel, const uint32_t feature)
+{
+	abort();
+}
+
+bool can_check_bittiming_ok(const struct can_bittiming_const *btc,
+							const struct gs_device_bittiming *timing)
+{
+	abort();
+}
+
+void can_set_bittiming(struct can_channel *channel, const struct gs_device_bittiming *bt)
+{
+	abort();
+}
+
+void can_set_data_bittiming(struct can_channel *channel, const struct gs_device_bittiming *timing)
+{
+	abort();
+}
+
+bool can_check_tdc_ok(const struct gs_device_tdc_const *tdc_const, const struct gs_device_tdc *tdc)
+{
+	abort();
+}
+
+void can_set_tdc(struct can_channel *channel, const struct gs_device_tdc *tdc)
+{
+	abort();
+}
+
+void can_get_device_tdc(const struct can_channel *channel, struct gs_device_tdc *tdc)
+{
+	abort();
+}
+
+void can_get_device_state(const struct can_channel *channel, struct gs_device_state *state)
+{
+	abort();
+}
+
+bool can_check_bus_off_recovery_ok(const struct can_channel *channel)
+{
+	abort();
+}
+
+void can_schedule_bus_off_recovery(struct can_channel *channel, uint32_t delay_ms)
+{
+	abort();
+}
+
+void set_term(can_data_t *channel, enum gs_can_termination_state state)
+{
+	abort();
+}
+
+enum gs_can_termination_state get_term(can_data_t *channel)
+{
+	abort();
+}
+
+void led_set_mode(led_data_t *leds, led_mode_t mode)
+{
+	abort();
+}
+
+void led_run_sequence(led_data_t *leds, const led_seq_step_t *sequence, int32_t num_repeat)
+{
+	abort();
+}
@@ -0,0 +1,147 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Round trip of frames through the compact record encoder and decoder,
+ * including the TX status of echoes, and the resulting bytes per frame
+ * compared to struct gs_host_frame.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "gs_host_frame_compact.h"
+#include "test_util.h"
+
+static size_t frame_size(const struct gs_host_frame *frame)
+{
+	if (frame->flags & GS_CAN_FLAG_FD)
+		return sizeof(*frame) + sizeof(struct canfd_ts);
+
+	return sizeof(*frame) + sizeof(struct classic_can_ts);
+}
+
+// test_frame_init(), with the TX states of echoes and an overflow now
+// and then.
+static void frame_init(union test_frame *f, unsigned int i, bool fd)
+{
+	static const u8 tx_status[] = {
+		0, GS_CAN_FLAG_TX_EXPIRED, GS_CAN_FLAG_TX_ABORTED, GS_CAN_FLAG_TX_FAILED,
+	};
+
+	test_frame_init(f, i, fd);
+
+	if (f->frame.echo_id != GS_HOST_FRAME_ECHO_ID_RX)
+		f->frame.flags |= tx_status[i / 3 % 4];
+	if (i % 61 == 0)
+		f->frame.flags |= GS_CAN_FLAG_OVERFLOW;
+}
+
+static void test_round_trip(bool fd)
+{
+	struct gs_host_frame_compact_ts ts[TEST_NR_CHANNELS] = { 0 };
+	uint32_t timestamp_us[16] = { 0 };
+	static u8 buf[1000 * (sizeof(struct gs_host_frame_compact) + 2 * sizeof(u32) + 64)];
+	size_t len = 0, len_frame = 0;
+	unsigned int i;
+
+	for (i = 0; i < 1000; i++) {
+		union test_frame f;
+
+		frame_init(&f, i, fd);
+		const size_t data_len = can_dlc2len(f.frame.can_dlc, fd);
+		const size_t record_len =
+			gs_host_frame_compact_encode(&f.frame, fd, f.frame.channel,
+										 &ts[f.frame.channel], &buf[len]);
+
+		assert(record_len <= gs_host_frame_compact_size_max(data_len));
+		len += record_len;
+		len_frame += frame_size(&f.frame);
+	}
+
+	size_t offset = 0;
+	for (i = 0; i < 1000; i++) {
+		union test_frame expected, decoded;
+
+		frame_init(&expected, i, fd);
+		memset(&decoded, 0xaa, sizeof(decoded));
+
+		// a truncated record must not be decoded
+		assert(gs_host_frame_compact_decode(&buf[offset], sizeof(struct gs_host_frame_compact) - 1,
+											timestamp_us, &decoded.frame) == 0);
+
+		const size_t record_len =
+			gs_host_frame_compact_decode(&buf[offset], len - offset,
+										 timestamp_us, &decoded.frame);
+		const size_t data_len = can_dlc2len(expected.frame.can_dlc, fd);
+
+		assert(record_len);
+		assert(decoded.frame.echo_id == expected.frame.echo_id);
+		assert(decoded.frame.can_id == expected.frame.can_id);
+		assert(decoded.frame.can_dlc == expected.frame.can_dlc);
+		assert(decoded.frame.channel == expected.frame.channel);
+		assert(decoded.frame.flags == expected.frame.flags);
+		assert(!memcmp(decoded.frame.canfd->data, expected.frame.canfd->data, data_len));
+		assert(*test_frame_timestamp(&decoded.frame) ==
+			   *test_frame_timestamp(&expected.frame));
+
+		offset += record_len;
+	}
+	assert(offset == len);
+
+	printf("%s: %zu bytes per frame, compact %.1f bytes per frame (%.0f%%)\n",
+		   fd ? "CAN-FD" : "classic CAN",
+		   len_frame / i, (double)len / i, 100.0 * len / len_frame);
+}
+
+// Without CAN-FD the encoder must ignore the FD flags of the host,
+// e.g. of an echo of an expired frame.
+static void test_classic_ignores_fd(void)
+{
+	struct gs_host_frame_compact_ts ts = { 0 };
+	uint32_t timestamp_us[16] = { 0 };
+	union test_frame f, decoded;
+	u8 buf[64];
+
+	frame_init(&f, 3, false);
+	f.frame.can_dlc = 15;
+	f.frame.flags |= GS_CAN_FLAG_FD | GS_CAN_FLAG_BRS;
+
+	const size_t len = gs_host_frame_compact_encode(&f.frame, false, 0, &ts, buf);
+
+	assert(len <= gs_host_frame_compact_size_max(8));
+	assert(gs_host_frame_compact_decode(buf, len, timestamp_us, &decoded.frame) == len);
+	assert(!(decoded.frame.flags & (GS_CAN_FLAG_FD | GS_CAN_FLAG_BRS)));
+	assert(decoded.frame.flags & GS_CAN_FLAG_TX_EXPIRED);
+}
+
+int main(void)
+{
+	test_round_trip(false);
+	test_round_trip(true);
+	test_classic_ignores_fd();
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * frame_heap ordering, including equal keys across the wrap of the
+ * sequence numbers, and the CAN arbitration order of can_tx_prio_key().
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "frame_heap.h"
+
+static uint32_t key_of(uint32_t can_id)
+{
+	const struct gs_host_frame frame = {
+		.can_id = can_id,
+	};
+
+	return can_tx_prio_key(&frame);
+}
+
+static void test_order(void)
+{
+	static struct frame_heap heap;
+	frame_ring_idx_t idx;
+
+	frame_heap_init(&heap);
+	srand(1);
+
+	for (unsigned int l = 0; l < 1000; l++) {
+		uint32_t key[FRAME_HEAP_SIZE];
+
+		for (unsigned int i = 0; i < FRAME_HEAP_SIZE; i++) {
+			key[i] = rand() % 8;
+			frame_heap_push(&heap, key[i], i);
+		}
+		assert(frame_heap_is_full(&heap));
+
+		uint32_t prev_key = 0;
+		frame_ring_idx_t prev_idx = 0;
+		for (unsigned int i = 0; i < FRAME_HEAP_SIZE; i++) {
+			assert(frame_heap_peek(&heap, &idx));
+			frame_heap_pop(&heap);
+
+			// ascending keys, equal keys in the order pushed
+			assert(key[idx] >= prev_key);
+			if (i && key[idx] == prev_key)
+				assert(idx > prev_idx);
+
+			prev_key = key[idx];
+			prev_idx = idx;
+		}
+		assert(frame_heap_is_empty(&heap));
+		assert(!frame_heap_peek(&heap, &idx));
+	}
+}
+
+static void test_seq_wrap(void)
+{
+	static struct frame_heap heap;
+	frame_ring_idx_t idx;
+
+	frame_heap_init(&heap);
+	heap.seq = UINT16_MAX - FRAME_HEAP_SIZE / 2;
+
+	for (unsigned int i = 0; i < FRAME_HEAP_SIZE; i++)
+		frame_heap_push(&heap, 0x42, i);
+
+	for (unsigned int i = 0; i < FRAME_HEAP_SIZE; i++) {
+		assert(frame_heap_peek(&heap, &idx));
+		assert(idx == i);
+		frame_heap_pop(&heap);
+	}
+}
+
+static void test_replace(void)
+{
+	static struct frame_heap heap;
+	frame_ring_idx_t idx;
+
+	frame_heap_init(&heap);
+	frame_heap_push(&heap, 2, 0);
+	frame_heap_push(&heap, 1, 1);
+	frame_heap_push(&heap, 2, 2);
+
+	// the replacement keeps the place of the replaced index
+	assert(frame_heap_replace(&heap, 0, 10));
+	assert(!frame_heap_replace(&heap, 0, 11));
+
+	assert(frame_heap_peek(&heap, &idx) && idx == 1);
+	frame_heap_pop(&heap);
+	assert(frame_heap_peek(&heap, &idx) && idx == 10);
+	frame_heap_pop(&heap);
+	assert(frame_heap_peek(&heap, &idx) && idx == 2);
+	frame_heap_pop(&heap);
+}
+
+static void test_prio_key(void)
+{
+	const uint32_t ext = 0x123 << 18 | 0x2abcd;
+
+	// lower ID first
+	assert(key_of(0x100) < key_of(0x101));
+	assert(key_of(0x100 << 18 | CAN_EFF_FLAG) < key_of(0x100 << 18 | 1 | CAN_EFF_FLAG));
+
+	// data frame before remote frame of the same ID
+	assert(key_of(0x123) < key_of(0x123 | CAN_RTR_FLAG));
+	assert(key_of(ext | CAN_EFF_FLAG) < key_of(ext | CAN_EFF_FLAG | CAN_RTR_FLAG));
+
+	// standard before extended frame of the same base ID, even
+	// a remote one, as its IDE bit is dominant
+	assert(key_of(0x123) < key_of(ext | CAN_EFF_FLAG));
+	assert(key_of(0x123 | CAN_RTR_FLAG) < key_of(ext | CAN_EFF_FLAG));
+	assert(key_of(0x123 | CAN_RTR_FLAG) < key_of(0x123 << 18 | CAN_EFF_FLAG));
+
+	// the base ID wins over the frame format
+	assert(key_of(0x122 << 18 | 0x3ffff | CAN_EFF_FLAG | CAN_RTR_FLAG) < key_of(0x123));
+	assert(key_of(0x123) < key_of(0x124 << 18 | CAN_EFF_FLAG));
+}
+
+int main(void)
+{
+	test_order();
+	test_seq_wrap();
+	test_replace();
+	test_prio_key();
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * frame_ring push, pop and flush across the wrap of the free running
+ * indices, and the time of a push and pop on the host.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include "frame_ring.h"
+#include "test_util.h"
+
+static void test_fifo(struct frame_ring *ring)
+{
+	frame_ring_idx_t idx, next = 0;
+
+	for (unsigned int l = 0; l < 1000; l++) {
+		const unsigned int n = l % FRAME_RING_SIZE + 1;
+
+		assert(frame_ring_is_empty(ring));
+		for (unsigned int i = 0; i < n; i++)
+			frame_ring_push(ring, (frame_ring_idx_t)(next + i));
+		assert(frame_ring_count(ring) == n);
+
+		for (unsigned int i = 0; i < n; i++) {
+			assert(frame_ring_peek(ring, &idx));
+			assert(idx == next++);
+			frame_ring_pop(ring);
+		}
+		assert(!frame_ring_peek(ring, &idx));
+	}
+}
+
+static void test_flush(struct frame_ring *ring)
+{
+	frame_ring_idx_t idx;
+
+	frame_ring_push(ring, 1);
+	frame_ring_push(ring, 2);
+	assert(!frame_ring_peek_flushed(ring, &idx));
+
+	frame_ring_flush(ring);
+	frame_ring_push(ring, 3);
+
+	// only the entries before the flush are returned
+	assert(frame_ring_peek_flushed(ring, &idx) && idx == 1);
+	frame_ring_pop(ring);
+	assert(frame_ring_peek_flushed(ring, &idx) && idx == 2);
+	frame_ring_pop(ring);
+	assert(!frame_ring_peek_flushed(ring, &idx));
+
+	assert(frame_ring_peek(ring, &idx) && idx == 3);
+	frame_ring_pop(ring);
+	assert(frame_ring_is_empty(ring));
+}
+
+static void bench_push_pop(void *arg)
+{
+	struct frame_ring *ring = arg;
+	frame_ring_idx_t idx;
+
+	for (unsigned int i = 0; i < FRAME_RING_SIZE; i++)
+		frame_ring_push(ring, i);
+
+	while (frame_ring_peek(ring, &idx)) {
+		assert(idx < FRAME_RING_SIZE);
+		frame_ring_pop(ring);
+	}
+}
+
+static void bench(struct frame_ring *ring)
+{
+	const double ns = test_bench_ns(bench_push_pop, ring, 200000);
+
+	printf("push + pop: %.1f ns\n", ns / FRAME_RING_SIZE);
+}
+
+int main(void)
+{
+	struct frame_ring ring;
+
+	frame_ring_init(&ring);
+	// start close to the wrap of the free running indices
+	ring.head = ring.tail = UINT_MAX - 100;
+
+	test_fifo(&ring);
+	test_flush(&ring);
+	bench(&ring);
+
+	return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Send frames of two channels sharing a pipe through the IN path of
+ * src/usbd_gs_can.c, with the endpoint stubbed. Every transfer is
+ * decoded by gs_host_frame_batch_decode() and checked against the
+ * frames queued, and the ZLP after a transfer of full packets is
+ * checked. Then report the transfers and packets per frame measured
+ * over queue depth, with and without GS_CAN_FEATURE_IN_BATCH, and the
+ * frames per second of the firmware's IN path.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "gs_host_frame_batch.h"
+#include "host_frame.h"
+#include "test_util.h"
+#include "usbd_core.h"
+#include "usbd_gs_can.h"
+
+#define NR_FRAMES 2000
+
+static USBD_GS_CAN_HandleTypeDef hcan;
+static USBD_HandleTypeDef pdev;
+static uint8_t __aligned(4) pool_buf[32 * 1024];
+
+// the IN endpoint of the pipe shared by both channels
+static struct {
+	bool busy;
+	bool zlp_due;
+	uint16_t len;
+	u8 data[USBD_GS_CAN_IN_BATCH_SIZE];
+} ep_in;
+
+static struct {
+	unsigned int transfers;
+	unsigned int packets;
+	unsigned int zlps;
+} stats;
+
+static bool verify = true;
+static uint32_t feature[TEST_NR_CHANNELS];
+static unsigned int next_expected[TEST_NR_CHANNELS];
+
+USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef *dev, uint8_t ep_addr,
+									uint8_t *pbuf, uint16_t size)
+{
+	assert(dev == &pdev);
+	assert(ep_addr == GSUSB_ENDPOINT_IN);
+	assert(!ep_in.busy);
+	assert(size <= sizeof(ep_in.data));
+
+	// a ZLP exactly after each transfer ending in a full packet
+	assert(ep_in.zlp_due == !size);
+	ep_in.zlp_due = size && size % CAN_DATA_MAX_PACKET_SIZE == 0;
+
+	ep_in.busy = true;
+	ep_in.len = size;
+	memcpy(ep_in.data, pbuf, size);
+
+	stats.transfers++;
+	stats.packets += size ? (size + CAN_DATA_MAX_PACKET_SIZE - 1) / CAN_DATA_MAX_PACKET_SIZE : 1;
+	if (!size)
+		stats.zlps++;
+
+	return USBD_OK;
+}
+
+static bool frame_is_fd(unsigned int i)
+{
+	return i % 3 == 2;
+}
+
+static void queue_frame(unsigned int i)
+{
+	const bool fd = frame_is_fd(i);
+	union test_frame f;
+
+	test_frame_init(&f, i, fd);
+
+	can_data_t *channel = &hcan.channels[f.frame.channel];
+	struct gs_host_frame_object *frame_object =
+		__gs_host_frame_object_get(&hcan, channel, fd, 0, false);
+
+	assert(frame_object);
+	memcpy(&frame_object->frame, &f.frame,
+		   fd ? GS_HOST_FRAME_SIZE : GS_HOST_FRAME_CLASSIC_SIZE);
+	list_add_tail(&frame_object->list, &channel->list_to_host);
+}
+
+// Check the frames of the transfer on ep_in, return their number.
+static unsigned int check_transfer(void)
+{
+	size_t offset = 0, size;
+	unsigned int n = 0;
+	bool single = false;
+	union test_frame decoded = { 0 };
+
+	while ((size = gs_host_frame_batch_decode(ep_in.data + offset, ep_in.len - offset,
+											  feature, TEST_NR_CHANNELS,
+											  &decoded.frame))) {
+		const unsigned int i = next_expected[decoded.frame.channel];
+		union test_frame expected;
+
+		test_frame_init(&expected, i, frame_is_fd(i));
+		assert(!memcmp(&decoded, &expected, sizeof(decoded)));
+
+		// frames of channels without IN_BATCH are sent one by one
+		assert(!single);
+		single = !(feature[decoded.frame.channel] & GS_CAN_FEATURE_IN_BATCH);
+		assert(!single || !n);
+
+		next_expected[decoded.frame.channel] += TEST_NR_CHANNELS;
+		offset += size;
+		n++;
+
+		memset(&decoded, 0, sizeof(decoded));
+	}
+
+	assert(offset == ep_in.len);
+
+	return n;
+}
+
+// Complete the transfers on ep_in until the firmware has nothing left
+// to send, return the number of frames sent.
+static unsigned int drain(void)
+{
+	unsigned int frames = 0;
+
+	USBD_GS_CAN_SendToHost(&pdev);
+
+	while (ep_in.busy) {
+		if (verify && ep_in.len)
+			frames += check_transfer();
+
+		ep_in.busy = false;
+		USBD_GS_CAN.DataIn(&pdev, GSUSB_ENDPOINT_IN & 0x7f);
+	}
+
+	return frames;
+}
+
+// Send NR_FRAMES frames, depth of them queued at a time.
+static void run(const uint32_t *channel_feature, unsigned int depth)
+{
+	unsigned int frames = 0;
+
+	memset(&stats, 0, sizeof(stats));
+
+	for (unsigned int c = 0; c < TEST_NR_CHANNELS; c++) {
+		feature[c] = channel_feature[c];
+		hcan.channels[c].feature = channel_feature[c];
+		next_expected[c] = c;
+	}
+
+	for (unsigned int i = 0; i < NR_FRAMES; i += depth) {
+		for (unsigned int j = i; j < MIN(i + depth, NR_FRAMES); j++)
+			queue_frame(j);
+
+		frames += drain();
+	}
+
+	if (verify)
+		assert(frames == NR_FRAMES);
+	assert(gs_host_frame_pool_free(&hcan) == gs_host_frame_pool_size(&hcan));
+}
+
+static void init(void)
+{
+	gs_host_frame_pool_init(&hcan, pool_buf, pool_buf + sizeof(pool_buf));
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(hcan.channels); i++) {
+		can_data_t *channel = &hcan.channels[i];
+
+		can_channel_set_nr(channel, i);
+		INIT_LIST_HEAD(&channel->list_to_host);
+		channel->state = GS_CAN_STATE_ERROR_ACTIVE;
+	}
+
+	USBD_GS_CAN_Init(&hcan, &pdev);
+}
+
+#define FEATURE_BATCH (GS_CAN_FEATURE_IN_BATCH | GS_CAN_FEATURE_HW_TIMESTAMP)
+#define FEATURE_SINGLE GS_CAN_FEATURE_HW_TIMESTAMP
+
+static const uint32_t feature_batch[TEST_NR_CHANNELS] = {
+	FEATURE_BATCH,
+	FEATURE_BATCH | GS_CAN_FEATURE_FD_DLC_TRIM,
+};
+
+static const uint32_t feature_single[TEST_NR_CHANNELS] = {
+	FEATURE_SINGLE,
+	FEATURE_SINGLE | GS_CAN_FEATURE_FD_DLC_TRIM,
+};
+
+static const uint32_t feature_mixed[TEST_NR_CHANNELS] = {
+	FEATURE_BATCH,
+	FEATURE_SINGLE | GS_CAN_FEATURE_FD_DLC_TRIM,
+};
+
+static const unsigned int depths[] = { 1, 2, 4, 8, 16, 32 };
+
+static void test_in_path(void)
+{
+	const uint32_t *features[] = { feature_batch, feature_single, feature_mixed };
+	unsigned int zlps = 0;
+
+	for (size_t f = 0; f < ARRAY_SIZE(features); f++) {
+		for (size_t d = 0; d < ARRAY_SIZE(depths); d++) {
+			run(features[f], depths[d]);
+			zlps += stats.zlps;
+		}
+	}
+
+	// the ZLP rule has been exercised
+	assert(zlps);
+}
+
+static unsigned int bench_depth;
+
+static void bench_run(void *arg)
+{
+	run(arg, bench_depth);
+}
+
+static void bench(void)
+{
+	printf("depth  batch: frames/transfer  packets/frame  single: packets/frame  IN path [frames/s]\n");
+
+	for (size_t d = 0; d < ARRAY_SIZE(depths); d++) {
+		run(feature_single, depths[d]);
+		const double single = (double)stats.packets / NR_FRAMES;
+
+		run(feature_batch, depths[d]);
+		const double transfers = stats.transfers - stats.zlps;
+		const double packets = stats.packets;
+
+		verify = false;
+		bench_depth = depths[d];
+		const double ns = test_bench_ns(bench_run, (void *)feature_batch, 200);
+		verify = true;
+
+		printf("%5u  %22.2f  %13.2f  %20.2f  %18.3g\n",
+			   depths[d], NR_FRAMES / transfers, packets / NR_FRAMES, single,
+			   NR_FRAMES * 1e9 / ns);
+	}
+}
+
+int main(void)
+{
+	init();
+	test_in_path();
+	bench();
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Marc Kleine-Budde <kernel@pengutronix.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+// Fixture shared by the host tests.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "gs_host_frame_compact.h"
+#include "gs_usb.h"
+
+#define TEST_NR_CHANNELS 2
+
+// A frame with room for CAN-FD data and the timestamp.
+union test_frame {
+	struct gs_host_frame frame;
+	u8 buf[sizeof(struct gs_host_frame) + sizeof(struct canfd_ts)];
+};
+
+static inline uint32_t *test_frame_timestamp(struct gs_host_frame *frame)
+{
+	if (frame->flags & GS_CAN_FLAG_FD)
+		return &frame->canfd_ts->timestamp_us;
+
+	return &frame->classic_can_ts->timestamp_us;
+}
+
+// Frame number i of a sequence: alternating channels, standard and
+// extended IDs, all DLCs, every third frame an RX frame, the others
+// echoes. The timestamps mostly advance by small deltas, now and then
+// by one that needs an absolute timestamp in a compact record.
+static inline void test_frame_init(union test_frame *f, unsigned int i, bool fd)
+{
+	struct gs_host_frame *frame = &f->frame;
+
+	memset(f, 0, sizeof(*f));
+
+	frame->channel = i % TEST_NR_CHANNELS;
+	frame->can_id = i & 1 ? ((i * 7919) & 0x1fffffff) | CAN_EFF_FLAG : i & 0x7ff;
+	frame->can_dlc = i % (fd ? 16 : 9);
+	frame->echo_id = i % 3 ? GS_HOST_FRAME_ECHO_ID_RX : i;
+
+	if (fd)
+		frame->flags = GS_CAN_FLAG_FD | (i & 2 ? GS_CAN_FLAG_BRS : 0);
+
+	for (size_t j = 0; j < can_dlc2len(frame->can_dlc, fd); j++)
+		frame->canfd->data[j] = i + j;
+
+	*test_frame_timestamp(frame) = i * 150 + (i % 97 == 0 ? i * 100000 : 0);
+}
+
+// Call fn loops times, return the time of a single call in ns.
+static inline double test_bench_ns(void (*fn)(void *arg), void *arg, unsigned int loops)
+{
+	const clock_t start = clock();
+
+	for (unsigned int i = 0; i < loops; i++)
+		fn(arg);
+
+	return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / loops;
+}